@@ -0,0 +1,193 @@
+/* rawhid_bench - compares the io_uring and the read() receive path of the Linux backend
+ *
+ *   make bench
+ *   bench/rawhid_bench /dev/hidraw3 [seconds] [-w] [-b]
+ *   bench/rawhid_bench -s <reports per second> [seconds] [-w] [-b]
+ *
+ * The device has to stream input reports on its own while this runs. With -s there is no
+ * device: a child process streams 64-byte reports at the given rate through a SOCK_SEQPACKET
+ * socket pair, which like hidraw is non-blocking, pollable and returns one report per read,
+ * and discards what is sent to it. Its CPU time is not counted. For each path the
+ * device is opened, reports are drained the way the [rawhid] I/O thread does it (wait on
+ * rawhid_fd, then receive until nothing is left), and the process CPU time is measured.
+ * With -w, output reports are sent as fast as the backend takes them as well. With -b,
+ * reports are received with rawhid_recv_batch instead of one rawhid_recv call each.
+ * The last column counts the io_uring worker threads (iou-wrk) of the process at the end of
+ * the run; a read waiting on a blocking descriptor would hold one each.
+ */
+#include "../hid_LINUX.hpp"
+#include <dirent.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#undef printf
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double cpu(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+		ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+// threads of this process named iou-wrk-<pid>
+static int workers(void)
+{
+	DIR *dir = opendir("/proc/self/task");
+	struct dirent *e;
+	char path[300], comm[32];
+	FILE *f;
+	int n = 0;
+
+	if (!dir) return -1;
+	while ((e = readdir(dir))) {
+		if (e->d_name[0] == '.') continue;
+		snprintf(path, sizeof(path), "/proc/self/task/%s/comm", e->d_name);
+		if (!(f = fopen(path, "r"))) continue;
+		if (fgets(comm, sizeof(comm), f) && !strncmp(comm, "iou-wrk", 7)) n++;
+		fclose(f);
+	}
+	closedir(dir);
+	return n;
+}
+
+#define BATCH 32
+
+static pid_t feeder = -1;
+
+// opens the device, or with rate > 0 starts a feeder process and opens its end of the socket
+static int source_open(const char *path, double rate)
+{
+	unsigned char report[BUFFER_SIZE] = { 0 }, sink[BUFFER_SIZE + 1];
+	struct timespec next;
+	long step, per_ms;
+	int sv[2], i;
+
+	if (rate <= 0) return rawhid_open_path(path);
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) return 0;
+	feeder = fork();
+	if (feeder < 0) return 0;
+	if (!feeder) {
+		close(sv[0]);
+		fcntl(sv[1], F_SETFL, O_NONBLOCK);
+		// one burst per millisecond, like a high-speed device polled every 125 us
+		per_ms = (long)(rate / 1000 + 0.5);
+		step = 1000000;
+		if (per_ms < 1) {
+			per_ms = 1;
+			step = (long)(1e9 / rate);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &next);
+		for (;;) {
+			for (i = 0; i < per_ms; i++) {
+				report[1]++;
+				if (write(sv[1], report, sizeof(report)) < 0 && errno != EAGAIN)
+					_exit(0);
+			}
+			while (read(sv[1], sink, sizeof(sink)) > 0) ;
+			next.tv_nsec += step;
+			while (next.tv_nsec >= 1000000000L) {
+				next.tv_sec++;
+				next.tv_nsec -= 1000000000L;
+			}
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		}
+	}
+	close(sv[1]);
+	fcntl(sv[0], F_SETFL, O_NONBLOCK);
+	if (hid_count) free_all_hid();
+	hid_start(&hid_list[0], sv[0]);
+	hid_count = 1;
+	return 1;
+}
+
+static void source_close(void)
+{
+	rawhid_close(0);
+	if (feeder > 0) {
+		kill(feeder, SIGKILL);
+		waitpid(feeder, NULL, 0);
+		feeder = -1;
+	}
+}
+
+static int run(const char *path, double rate, double seconds, int send, int uring, int batch)
+{
+	unsigned char buf[BUFFER_SIZE] = { 0 };
+	unsigned char reports[BATCH][RAWHID_REPORT_SIZE];
+	int lengths[BATCH];
+	struct pollfd pfd;
+	unsigned long received = 0, sent = 0;
+	double t0, c0, t, c;
+	int r, w;
+
+	hid_use_uring = uring;
+	if (!source_open(path, rate)) {
+		fprintf(stderr, "cannot open %s\n", rate > 0 ? "a socket pair" : path);
+		return 1;
+	}
+	if (uring && !hid_list[0].ring) {
+		fprintf(stderr, "io_uring not available, skipping\n");
+		source_close();
+		return 0;
+	}
+	t0 = now();
+	c0 = cpu();
+	while (now() - t0 < seconds) {
+		if (send && rawhid_send(0, buf, BUFFER_SIZE, 0) > 0) sent++;
+		pfd.fd = rawhid_fd(0);
+		pfd.events = POLLIN;
+		if (!send && poll(&pfd, 1, 100) <= 0) continue;
+		if (batch) {
+			while ((r = rawhid_recv_batch(0, reports, BATCH, lengths, NULL, 0)) > 0)
+				received += r;
+		} else {
+			while ((r = rawhid_recv(0, buf, BUFFER_SIZE, 0)) > 0) received++;
+		}
+		if (r < 0) {
+			fprintf(stderr, "device went away\n");
+			break;
+		}
+	}
+	t = now() - t0;
+	c = (cpu() - c0) / t * 100;
+	w = workers();
+	source_close();
+	printf("%-8s %10.0f reports/s in %10.0f out %6.1f %% cpu %10.0f reports/s per cpu %% "
+		"%3d workers\n", uring ? "io_uring" : "read", received / t, sent / t, c,
+		c > 0 ? (received + sent) / t / c : 0, w);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	double seconds = 5, rate = 0;
+	int send = 0, batch = 0, i;
+	const char *path = NULL;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-w")) send = 1;
+		else if (!strcmp(argv[i], "-b")) batch = 1;
+		else if (!strcmp(argv[i], "-s") && i + 1 < argc) rate = atof(argv[++i]);
+		else if (!path && rate <= 0) path = argv[i];
+		else seconds = atof(argv[i]);
+	}
+	if (!path && rate <= 0) {
+		fprintf(stderr, "usage: %s <hidraw device> | -s <reports per second> [seconds] [-w] "
+			"[-b]\n", argv[0]);
+		return 2;
+	}
+	return run(path, rate, seconds, send, 1, batch) || run(path, rate, seconds, send, 0, batch);
+}
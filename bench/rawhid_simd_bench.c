@@ -0,0 +1,152 @@
+/* rawhid_simd_bench - times the conversion kernels of rawhid_simd.hpp against the scalar loops
+ *
+ *   make bench
+ *   bench/rawhid_simd_bench [milliseconds per measurement]
+ *
+ * For 64, 128, 256, 512 and 1024 elements every kernel this CPU can run is first checked
+ * against the scalar loop, then called in a tight loop. The tables give ns per call, and in
+ * parentheses how many times faster than scalar that is.
+ */
+#include "../m_pd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../rawhid_simd.hpp"
+
+#define MAXN 1024
+
+/* the one Pd function the scalar kernel calls, as Pd defines it */
+t_int atom_getint(t_atom *a)
+{
+	return (a->a_type == A_FLOAT) ? (t_int)a->a_w.w_float : 0;
+}
+
+typedef struct kernel {
+	const char *name;
+	t_rawhid_b2a b2a;
+	t_rawhid_a2b a2b;
+} kernel_t;
+
+static kernel_t kernels[4];
+static int nkernels;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void add(const char *name, t_rawhid_b2a b2a, t_rawhid_a2b a2b)
+{
+	kernels[nkernels].name = name;
+	kernels[nkernels].b2a = b2a;
+	kernels[nkernels].a2b = a2b;
+	nkernels++;
+}
+
+static unsigned char bytes[MAXN], out[MAXN], ref[MAXN];
+static t_atom atoms[MAXN], outatoms[MAXN], refatoms[MAXN];
+static volatile unsigned sink;
+static t_symbol notfloat = {"x", 0, 0};
+
+/* ns per call of one direction of kernel k over n elements */
+static double time_kernel(int k, int dir, int n, double seconds)
+{
+	long calls = 0, i;
+	double t0 = now(), t;
+
+	do {
+		for (i = 0; i < 1000; i++) {
+			if (dir == 0) {
+				kernels[k].b2a(bytes, outatoms, n);
+				sink += outatoms[n - 1].a_type;
+			} else {
+				kernels[k].a2b(atoms, out, n);
+				sink += out[n - 1];
+			}
+		}
+		calls += 1000;
+	} while ((t = now() - t0) < seconds);
+	return t * 1e9 / calls;
+}
+
+static int check(int k, int n)
+{
+	int i;
+
+	memset(outatoms, 0, sizeof(outatoms));
+	memset(out, 0, sizeof(out));
+	rawhid_bytes_to_atoms_scalar(bytes, refatoms, n);
+	rawhid_atoms_to_bytes_scalar(atoms, ref, n);
+	kernels[k].b2a(bytes, outatoms, n);
+	kernels[k].a2b(atoms, out, n);
+	for (i = 0; i < n; i++) {
+		if (outatoms[i].a_type != refatoms[i].a_type ||
+		    outatoms[i].a_w.w_float != refatoms[i].a_w.w_float || out[i] != ref[i])
+			return 0;
+	}
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	static const char *dirs[] = {"bytes->atoms", "atoms->bytes"};
+	double seconds = (argc > 1 ? atof(argv[1]) : 200) / 1000.;
+	double scalar, ns;
+	int i, k, n, dir;
+
+	for (i = 0; i < MAXN; i++) {
+		bytes[i] = rand();
+		SETFLOAT(atoms + i, (rand() % 1000) - 500 + (rand() % 100) / 100.);
+	}
+	SETSYMBOL(atoms + 7, &notfloat); /* non-float atoms convert to 0 */
+
+	add("scalar", rawhid_bytes_to_atoms_scalar, rawhid_atoms_to_bytes_scalar);
+	if (RAWHID_ATOM_VECTORIZABLE) {
+#ifdef RAWHID_HAVE_SSE2
+		add("sse2", rawhid_bytes_to_atoms_sse2, rawhid_atoms_to_bytes_sse2);
+#endif
+#ifdef RAWHID_HAVE_AVX2
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			add("avx2", rawhid_bytes_to_atoms_avx2, rawhid_atoms_to_bytes_avx2);
+#endif
+#ifdef RAWHID_HAVE_NEON
+		add("neon", rawhid_bytes_to_atoms_neon, rawhid_atoms_to_bytes_neon);
+#endif
+	} else {
+		printf("t_atom layout is not vectorizable, only the scalar loops are built in\n");
+	}
+
+	rawhid_simd_init();
+	printf("runtime dispatch picks %s\n", rawhid_simd_name());
+	for (k = 1; k < nkernels; k++) {
+		for (n = 0; n <= 80; n++) {
+			if (!check(k, n)) {
+				printf("%s differs from scalar at %d elements\n", kernels[k].name, n);
+				return 1;
+			}
+		}
+	}
+
+	for (dir = 0; dir < 2; dir++) {
+		printf("\n%-12s", dirs[dir]);
+		for (k = 0; k < nkernels; k++)
+			printf("%16s", kernels[k].name);
+		printf("\n");
+		for (n = 64; n <= MAXN; n *= 2) {
+			printf("%8d    ", n);
+			scalar = time_kernel(0, dir, n, seconds);
+			printf("%16.1f", scalar);
+			for (k = 1; k < nkernels; k++) {
+				ns = time_kernel(k, dir, n, seconds);
+				printf("%9.1f (%4.1fx)", ns, scalar / ns);
+			}
+			printf("\n");
+		}
+	}
+	return 0;
+}
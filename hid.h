@@ -4,8 +4,16 @@
  *
  *  rawhid_open - open 1 or more devices
  *  rawhid_recv - receive a packet
+ *  rawhid_recv_batch - receive every waiting packet with one call
  *  rawhid_send - send a packet
  *  rawhid_close - close a device
+ *  rawhid_wait_attach - wait for a matching device to appear (thread safe)
+ *  rawhid_enumerate - describe matching devices without opening them (thread safe)
+ *  rawhid_open_path - open one device by the path rawhid_enumerate gave
+ *  rawhid_handle_open - open a device by path without listing it yet (thread safe)
+ *  rawhid_handle_adopt - make a device rawhid_handle_open gave the open device
+ *  rawhid_handle_close - close a device rawhid_handle_open gave instead (thread safe)
+ *  rawhid_fd - descriptor that polls readable when a device has reports, or -1
  *
  * Permission is hereby granted, free of charge, to any person obtaining a copy
  * of this software and associated documentation files (the "Software"), to deal
@@ -27,7 +35,67 @@
  *
  * Version 1.0: Initial Release
  */
+#ifndef RAWHID_HID_H
+#define RAWHID_HID_H
+
+typedef struct rawhid_devinfo {
+	int vid;
+	int pid;
+	int usage_page;
+	int usage;
+	int input_size;  /* largest input report, in bytes */
+	int output_size; /* largest output report, in bytes */
+	char serial[64];
+	char path[256];
+} rawhid_devinfo_t;
+
+/* A device rawhid_handle_open opened, not yet in the list of opened devices. */
+typedef struct rawhid_handle rawhid_handle_t;
+
 int rawhid_open(int max, int vid, int pid, int usage_page, int usage);
 int rawhid_recv(int num, void *buf, int len, int timeout);
+int rawhid_recv_batch(int num, void *buf, int max_reports, int *lengths, double *timestamps,
+		      int timeout);
 int rawhid_send(int num, void *buf, int len, int timeout);
 void rawhid_close(int num);
+int rawhid_wait_attach(int vid, int pid, int usage_page, int usage, int timeout);
+int rawhid_enumerate(rawhid_devinfo_t *list, int max, int vid, int pid, int usage_page, int usage);
+int rawhid_open_path(const char *path);
+rawhid_handle_t *rawhid_handle_open(const char *path);
+int rawhid_handle_adopt(rawhid_handle_t *handle);
+void rawhid_handle_close(rawhid_handle_t *handle);
+int rawhid_fd(int num);
+
+/* Every report handed through a backend fits in this many bytes: 64, after the report ID that
+ * hidraw puts first when the device numbers its reports. */
+#define RAWHID_REPORT_SIZE 65
+
+/* Backend capabilities */
+#define RAWHID_CAP_FD      1 /* fd() gives a descriptor that polls readable with reports */
+#define RAWHID_CAP_HOTPLUG 2 /* wait_attach() detects the device coming back, attach() reopens it */
+#define RAWHID_CAP_MULTI   4 /* several devices can be open at the same time */
+
+/* A device backend. open() returns a device number for the others, or -1. It opens the device
+ * at path when one is given, else the first one matching. recv_batch() copies up to
+ * max_reports queued reports into buf, RAWHID_REPORT_SIZE bytes apart, with their lengths and
+ * (if timestamps is not NULL) CLOCK_MONOTONIC arrival times in seconds. It waits up to timeout
+ * ms for the first one and returns how many it copied, or -1 once the device is gone.
+ * attach() opens a device like open() but from any thread, without touching the backend's
+ * tables; adopt() then gives it a device number as open() would, or release() closes it.
+ * wait_attach, attach, adopt, release and fd may be NULL when the capability is missing. */
+typedef struct rawhid_backend {
+	const char *name;
+	int caps;
+	int (*open)(const char *path, int vid, int pid, int usage_page, int usage);
+	int (*recv_batch)(int num, void *buf, int max_reports, int *lengths, double *timestamps,
+			  int timeout);
+	int (*send)(int num, void *buf, int len, int timeout);
+	void (*close)(int num);
+	int (*fd)(int num);
+	int (*wait_attach)(int vid, int pid, int usage_page, int usage, int timeout);
+	rawhid_handle_t *(*attach)(const char *path, int vid, int pid, int usage_page, int usage);
+	int (*adopt)(rawhid_handle_t *handle);
+	void (*release)(rawhid_handle_t *handle);
+} rawhid_backend_t;
+
+#endif
@@ -0,0 +1,604 @@
+/* Simple Raw HID functions for Linux - for use with Teensy RawHID example
+ * http://www.pjrc.com/teensy/rawhid.html
+ * Copyright (c) 2009 PJRC.COM, LLC
+ *
+ *  rawhid_open - open 1 or more devices
+ *  rawhid_recv - receive a packet
+ *  rawhid_recv_batch - receive every waiting packet
+ *  rawhid_send - send a packet
+ *  rawhid_close - close a device
+ *  rawhid_wait_attach - wait for a matching device to appear
+ *  rawhid_enumerate - list matching devices without opening them
+ *  rawhid_open_path - open one device by path
+ *  rawhid_fd - pollable descriptor of an open device
+ *
+ * This version talks to the kernel hidraw driver (/dev/hidraw*) instead of libusb,
+ * so it needs no extra library and no detaching of the kernel driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above description, website URL and copyright notice and this permission
+ * notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Version 1.0: Initial Release
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <sys/inotify.h>
+#include <linux/hidraw.h>
+
+#include "hid.h"
+
+#define BUFFER_SIZE 64
+#define MAX_HID 16
+#define HIDRAW_DIR "/dev"
+
+#define printf(...) // comment this out to get lots of info printed
+
+// arrival time of received packets, in CLOCK_MONOTONIC seconds
+static double hid_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// queued reads through io_uring where the headers have it, see hid_uring.hpp
+#if defined(__has_include) && !defined(HID_NO_URING)
+#if __has_include(<linux/io_uring.h>)
+#define HID_URING
+#include "hid_uring.hpp"
+#endif
+#endif
+
+
+// a list of all opened HID devices, so the caller can
+// simply refer to them by number
+typedef struct hid_struct hid_t;
+struct hid_struct {
+	int fd;
+	int open;
+	struct hid_uring *ring; // NULL on the poll()/read() path
+};
+static hid_t hid_list[MAX_HID];
+static int hid_count = 0;
+
+// a device opened by rawhid_handle_open, until rawhid_handle_adopt lists it
+struct rawhid_handle {
+	int fd;
+};
+
+// private functions, not intended to be used from outside this file
+static hid_t * get_hid(int);
+static void hid_start(hid_t *, int);
+static void hid_stop(hid_t *);
+static void free_all_hid(void);
+static int hid_match(const char *, int, int, int, int, rawhid_devinfo_t *);
+static int hid_parse_desc(int, rawhid_devinfo_t *);
+
+
+
+//  rawhid_recv - receive a packet
+//    Inputs:
+//	num = device to receive from (zero based)
+//	buf = buffer to receive packet
+//	len = buffer's size
+//	timeout = time to wait, in milliseconds
+//    Output:
+//	number of bytes received, or -1 on error
+//
+int rawhid_recv(int num, void *buf, int len, int timeout)
+{
+	hid_t *hid;
+	struct pollfd pfd;
+	int r;
+
+	if (len < 1) return 0;
+	hid = get_hid(num);
+	if (!hid || !hid->open) return -1;
+#ifdef HID_URING
+	if (hid->ring) return hid_uring_recv(hid->ring, buf, len, timeout);
+#endif
+	pfd.fd = hid->fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	r = poll(&pfd, 1, timeout);
+	if (r < 0) return (errno == EINTR) ? 0 : -1;
+	if (r == 0) return 0;
+	if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) return -1;
+	r = read(hid->fd, buf, len);
+	if (r < 0) {
+		if (errno == EAGAIN || errno == EINTR) return 0;
+		printf("rawhid_recv, read error %d\n", errno);
+		return -1;
+	}
+	return r;
+}
+
+
+//  rawhid_recv_batch - receive every packet that is waiting
+//    Inputs:
+//	num = device to receive from (zero based)
+//	buf = room for max_reports packets, RAWHID_REPORT_SIZE bytes apart
+//	max_reports = most packets to receive
+//	lengths = receives the size of each packet
+//	timestamps = receives the arrival time of each packet, or NULL
+//	timeout = time to wait for the first packet, in milliseconds
+//    Output:
+//	number of packets received, or -1 on error
+//
+int rawhid_recv_batch(int num, void *buf, int max_reports, int *lengths, double *timestamps,
+	int timeout)
+{
+	hid_t *hid;
+	struct pollfd pfd;
+	double now;
+	int n, r = 0;
+
+	hid = get_hid(num);
+	if (!hid || !hid->open) return -1;
+#ifdef HID_URING
+	if (hid->ring) return hid_uring_recv_batch(hid->ring, buf, max_reports, lengths,
+		timestamps, timeout);
+#endif
+	if (timeout != 0) {
+		pfd.fd = hid->fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		r = poll(&pfd, 1, timeout);
+		if (r < 0) return (errno == EINTR) ? 0 : -1;
+		if (r == 0) return 0;
+		if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) return -1;
+	}
+	// the descriptor is non-blocking, so this stops when the kernel queue is empty
+	for (n = 0; n < max_reports; n++) {
+		r = read(hid->fd, (uint8_t *)buf + n * RAWHID_REPORT_SIZE, RAWHID_REPORT_SIZE);
+		if (r <= 0) break;
+		lengths[n] = r;
+	}
+	if (r < 0 && errno != EAGAIN && errno != EINTR && !n) {
+		printf("rawhid_recv_batch, read error %d\n", errno);
+		return -1;
+	}
+	if (timestamps) {
+		now = hid_now();
+		for (r = 0; r < n; r++) timestamps[r] = now;
+	}
+	return n;
+}
+
+
+//  rawhid_send - send a packet
+//    Inputs:
+//	num = device to transmit to (zero based)
+//	buf = buffer containing packet to send
+//	len = number of bytes to transmit
+//	timeout = time to wait, in milliseconds
+//    Output:
+//	number of bytes sent, or -1 on error
+//
+int rawhid_send(int num, void *buf, int len, int timeout)
+{
+	hid_t *hid;
+	uint8_t report[BUFFER_SIZE + 1];
+	struct pollfd pfd;
+	int r;
+
+	hid = get_hid(num);
+	if (!hid || !hid->open) return -1;
+	if (len > BUFFER_SIZE) len = BUFFER_SIZE;
+#ifdef HID_URING
+	if (hid->ring) return hid_uring_send(hid->ring, buf, len);
+#endif
+	// like the other platforms we send unnumbered reports, which
+	// hidraw expects to be prefixed with a zero report ID
+	report[0] = 0;
+	memcpy(report + 1, buf, len);
+	pfd.fd = hid->fd;
+	pfd.events = POLLOUT;
+	pfd.revents = 0;
+	if (poll(&pfd, 1, timeout) <= 0) return 0;
+	r = write(hid->fd, report, len + 1);
+	if (r < 0) return (errno == EAGAIN) ? 0 : -1;
+	return (r > 0) ? r - 1 : 0;
+}
+
+
+//  rawhid_open - open 1 or more devices
+//
+//    Inputs:
+//	max = maximum number of devices to open
+//	vid = Vendor ID, or -1 if any
+//	pid = Product ID, or -1 if any
+//	usage_page = top level usage page, or -1 if any
+//	usage = top level usage number, or -1 if any
+//    Output:
+//	actual number of devices opened
+//
+int rawhid_open(int max, int vid, int pid, int usage_page, int usage)
+{
+	DIR *dir;
+	struct dirent *ent;
+	char path[sizeof(HIDRAW_DIR) + 256];
+	int fd;
+
+	if (hid_count) free_all_hid();
+	printf("rawhid_open, max=%d\n", max);
+	if (max < 1) return 0;
+	if (max > MAX_HID) max = MAX_HID;
+	dir = opendir(HIDRAW_DIR);
+	if (!dir) return 0;
+	while (hid_count < max && (ent = readdir(dir)) != NULL) {
+		if (strncmp(ent->d_name, "hidraw", 6) != 0) continue;
+		snprintf(path, sizeof(path), HIDRAW_DIR "/%s", ent->d_name);
+		fd = hid_match(path, vid, pid, usage_page, usage, NULL);
+		if (fd < 0) continue;
+		printf("rawhid_open, opened %s\n", path);
+		hid_start(&hid_list[hid_count], fd);
+		hid_count++;
+	}
+	closedir(dir);
+	return hid_count;
+}
+
+
+//  rawhid_close - close a device
+//
+//    Inputs:
+//	num = device to close (zero based)
+//    Output
+//	(nothing)
+//
+void rawhid_close(int num)
+{
+	hid_t *hid;
+
+	hid = get_hid(num);
+	if (!hid || !hid->open) return;
+	hid_stop(hid);
+}
+
+
+//  rawhid_wait_attach - wait for a matching device to be plugged in
+//
+//    Inputs:
+//	vid, pid, usage_page, usage = as for rawhid_open
+//	timeout = time to wait, in milliseconds
+//    Output:
+//	1 if a matching device is present, 0 on timeout, -1 on error
+//
+//    Does not touch the list of opened devices, so it may be called
+//    from another thread than the one using rawhid_recv/rawhid_send.
+//
+int rawhid_wait_attach(int vid, int pid, int usage_page, int usage, int timeout)
+{
+	char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct pollfd pfd;
+	DIR *dir;
+	struct dirent *ent;
+	char path[sizeof(HIDRAW_DIR) + 256];
+	int ifd, fd, found = 0;
+
+	// watch first, then scan, so a device created in between is not missed
+	ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (ifd < 0) return -1;
+	if (inotify_add_watch(ifd, HIDRAW_DIR, IN_CREATE | IN_ATTRIB) < 0) {
+		close(ifd);
+		return -1;
+	}
+	dir = opendir(HIDRAW_DIR);
+	while (dir && !found && (ent = readdir(dir)) != NULL) {
+		if (strncmp(ent->d_name, "hidraw", 6) != 0) continue;
+		snprintf(path, sizeof(path), HIDRAW_DIR "/%s", ent->d_name);
+		if ((fd = hid_match(path, vid, pid, usage_page, usage, NULL)) >= 0) {
+			close(fd);
+			found = 1;
+		}
+	}
+	if (dir) closedir(dir);
+	pfd.fd = ifd;
+	pfd.events = POLLIN;
+	while (!found && poll(&pfd, 1, timeout) > 0) {
+		ssize_t n = read(ifd, events, sizeof(events));
+		char *p;
+		for (p = events; n > 0 && p < events + n; ) {
+			struct inotify_event *ev = (struct inotify_event *)p;
+			// udev fixes up permissions after creating the node,
+			// hence IN_ATTRIB as well as IN_CREATE
+			if (ev->len && strncmp(ev->name, "hidraw", 6) == 0) {
+				snprintf(path, sizeof(path), HIDRAW_DIR "/%s", ev->name);
+				if ((fd = hid_match(path, vid, pid, usage_page, usage, NULL)) >= 0) {
+					close(fd);
+					found = 1;
+					break;
+				}
+			}
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+	close(ifd);
+	return found;
+}
+
+
+//  rawhid_enumerate - list matching devices without opening them
+//
+//    Inputs:
+//	list = array receiving the device descriptions
+//	max = size of list
+//	vid, pid, usage_page, usage = as for rawhid_open
+//    Output:
+//	number of devices written to list
+//
+//    Does not touch the list of opened devices, so it may be called
+//    from another thread than the one using rawhid_recv/rawhid_send.
+//
+int rawhid_enumerate(rawhid_devinfo_t *list, int max, int vid, int pid, int usage_page, int usage)
+{
+	DIR *dir;
+	struct dirent *ent;
+	char path[sizeof(HIDRAW_DIR) + 256];
+	int fd, count = 0;
+
+	dir = opendir(HIDRAW_DIR);
+	if (!dir) return 0;
+	while (count < max && (ent = readdir(dir)) != NULL) {
+		if (strncmp(ent->d_name, "hidraw", 6) != 0) continue;
+		snprintf(path, sizeof(path), HIDRAW_DIR "/%s", ent->d_name);
+		fd = hid_match(path, vid, pid, usage_page, usage, list + count);
+		if (fd < 0) continue;
+		close(fd);
+		count++;
+	}
+	closedir(dir);
+	return count;
+}
+
+
+//  rawhid_fd - descriptor of an open device, for epoll
+//
+//    Inputs:
+//	num = device (zero based)
+//    Output:
+//	the hidraw file descriptor, or -1 if the device is not open
+//
+int rawhid_fd(int num)
+{
+	hid_t *hid = get_hid(num);
+
+	if (!hid || !hid->open) return -1;
+#ifdef HID_URING
+	// the ring polls readable when completions are waiting
+	if (hid->ring) return hid->ring->fd;
+#endif
+	return hid->fd;
+}
+
+
+//  rawhid_open_path - open a single device by the path rawhid_enumerate gave
+//
+//    Inputs:
+//	path = device path
+//    Output:
+//	1 if the device was opened as device 0, 0 otherwise
+//
+int rawhid_open_path(const char *path)
+{
+	rawhid_handle_t *handle;
+
+	handle = rawhid_handle_open(path);
+	if (!handle) return 0;
+	return rawhid_handle_adopt(handle);
+}
+
+
+//  rawhid_handle_open - open a device without adding it to the list
+//
+//    Inputs:
+//	path = device path
+//    Output:
+//	the opened device, or NULL
+//
+//    Does not touch the list of opened devices, so it may be called
+//    from another thread than the one using rawhid_recv/rawhid_send.
+//
+rawhid_handle_t *rawhid_handle_open(const char *path)
+{
+	rawhid_handle_t *handle;
+	int fd;
+
+	fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) return NULL;
+	handle = (rawhid_handle_t *)malloc(sizeof(rawhid_handle_t));
+	if (!handle) {
+		close(fd);
+		return NULL;
+	}
+	handle->fd = fd;
+	return handle;
+}
+
+
+//  rawhid_handle_adopt - make an opened device device 0
+//
+//    Inputs:
+//	handle = what rawhid_handle_open gave, freed by this call
+//    Output:
+//	1 if the device is now device 0, 0 otherwise
+//
+int rawhid_handle_adopt(rawhid_handle_t *handle)
+{
+	if (hid_count) free_all_hid();
+	hid_start(&hid_list[0], handle->fd);
+	hid_count = 1;
+	free(handle);
+	return 1;
+}
+
+
+//  rawhid_handle_close - close a device that was never adopted
+//
+//    Inputs:
+//	handle = what rawhid_handle_open gave, freed by this call
+//
+void rawhid_handle_close(rawhid_handle_t *handle)
+{
+	close(handle->fd);
+	free(handle);
+}
+
+
+static hid_t * get_hid(int num)
+{
+	if (num < 0 || num >= hid_count) return NULL;
+	return hid_list + num;
+}
+
+
+static void hid_start(hid_t *hid, int fd)
+{
+	hid->fd = fd;
+	hid->open = 1;
+	hid->ring = NULL;
+#ifdef HID_URING
+	hid->ring = hid_uring_open(fd);
+#endif
+}
+
+
+static void hid_stop(hid_t *hid)
+{
+#ifdef HID_URING
+	if (hid->ring) hid_uring_close(hid->ring);
+	hid->ring = NULL;
+#endif
+	close(hid->fd);
+	hid->fd = -1;
+	hid->open = 0;
+}
+
+
+static void free_all_hid(void)
+{
+	int i;
+
+	for (i = 0; i < hid_count; i++) {
+		if (hid_list[i].open) hid_stop(&hid_list[i]);
+	}
+	hid_count = 0;
+}
+
+
+// opens path and returns its descriptor if the device matches, -1 otherwise.
+// if info is not NULL it is filled with the device's description.
+static int hid_match(const char *path, int vid, int pid, int usage_page, int usage,
+	rawhid_devinfo_t *info)
+{
+	struct hidraw_devinfo raw;
+	rawhid_devinfo_t desc;
+	int fd;
+
+	fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) return -1;
+	if (ioctl(fd, HIDIOCGRAWINFO, &raw) < 0) goto nomatch;
+	if (vid > 0 && (raw.vendor & 0xFFFF) != vid) goto nomatch;
+	if (pid > 0 && (raw.product & 0xFFFF) != pid) goto nomatch;
+	memset(&desc, 0, sizeof(desc));
+	desc.usage_page = desc.usage = -1;
+	if ((usage_page > 0 || usage > 0 || info) && hid_parse_desc(fd, &desc) < 0) {
+		if (usage_page > 0 || usage > 0) goto nomatch;
+	}
+	if (usage_page > 0 && desc.usage_page != usage_page) goto nomatch;
+	if (usage > 0 && desc.usage != usage) goto nomatch;
+	if (info) {
+		desc.vid = raw.vendor & 0xFFFF;
+		desc.pid = raw.product & 0xFFFF;
+#ifdef HIDIOCGRAWUNIQ
+		if (ioctl(fd, HIDIOCGRAWUNIQ(sizeof(desc.serial)), desc.serial) < 0)
+			desc.serial[0] = 0;
+		desc.serial[sizeof(desc.serial) - 1] = 0;
+#endif
+		if (strlen(path) >= sizeof(desc.path)) goto nomatch;
+		memcpy(desc.path, path, strlen(path) + 1);
+		*info = desc;
+	}
+	return fd;
+nomatch:
+	close(fd);
+	return -1;
+}
+
+
+// reads the usage page and usage of the first top level collection from
+// the report descriptor, and the size in bytes of its largest input and
+// output reports (including the report ID byte when IDs are used)
+static int hid_parse_desc(int fd, rawhid_devinfo_t *info)
+{
+	struct hidraw_report_descriptor desc;
+	int size, i, n, page = -1, u = -1, top = 0;
+	int rsize = 0, rcount = 0, ids = 0, in_bits = 0, out_bits = 0;
+	int max_in = 0, max_out = 0;
+	uint32_t val;
+
+	if (ioctl(fd, HIDIOCGRDESCSIZE, &size) < 0) return -1;
+	desc.size = size;
+	if (ioctl(fd, HIDIOCGRDESC, &desc) < 0) return -1;
+	for (i = 0; i < (int)desc.size; i += n + 1) {
+		uint8_t tag = desc.value[i];
+		if (tag == 0xFE) return -1; // long items are not expected here
+		n = tag & 0x03;
+		if (n == 3) n = 4;
+		if (i + n >= (int)desc.size) break;
+		val = 0;
+		if (n > 0) val |= desc.value[i + 1];
+		if (n > 1) val |= desc.value[i + 2] << 8;
+		if (n > 2) val |= (uint32_t)desc.value[i + 3] << 16 | (uint32_t)desc.value[i + 4] << 24;
+		switch (tag & 0xFC) {
+		case 0x04: if (!top) page = val; break;            // Usage Page
+		case 0x08: if (!top && u < 0) u = val; break;      // Usage
+		case 0x74: rsize = val; break;                      // Report Size
+		case 0x94: rcount = val; break;                     // Report Count
+		case 0x84:                                          // Report ID
+			ids = 1;
+			if (in_bits > max_in) max_in = in_bits;
+			if (out_bits > max_out) max_out = out_bits;
+			in_bits = out_bits = 0;
+			break;
+		case 0x80: in_bits += rsize * rcount; break;       // Input
+		case 0x90: out_bits += rsize * rcount; break;      // Output
+		case 0xA0: top = 1; break;                          // Collection
+		}
+	}
+	if (page < 0 || u < 0) return -1;
+	if (in_bits > max_in) max_in = in_bits;
+	if (out_bits > max_out) max_out = out_bits;
+	info->usage_page = page;
+	info->usage = u & 0xFFFF;
+	info->input_size = (max_in + 7) / 8 + ids;
+	info->output_size = (max_out + 7) / 8 + ids;
+	return 0;
+}
@@ -4,8 +4,13 @@
  *
  *  rawhid_open - open 1 or more devices
  *  rawhid_recv - receive a packet
+ *  rawhid_recv_batch - receive every waiting packet
  *  rawhid_send - send a packet
  *  rawhid_close - close a device
+ *  rawhid_wait_attach - wait for a matching device to appear
+ *  rawhid_enumerate - list matching devices without opening them
+ *  rawhid_open_path - open one device by path
+ *  rawhid_fd - always -1, reports arrive through the run loop
  *
  * Permission is hereby granted, free of charge, to any person obtaining a copy
  * of this software and associated documentation files (the "Software"), to deal
@@ -31,6 +36,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <time.h>
 #include <unistd.h>
 #include <IOKit/IOKitLib.h>
 #include <IOKit/hid/IOHIDLib.h>
@@ -38,6 +44,9 @@
 #include "hid.h"
 
 #define BUFFER_SIZE 64
+// reports kept per device between two rawhid_recv_batch calls. As many as the largest inbound
+// queue rawhid.c allows, so its overflow policy, not this buffer, decides what is dropped.
+#define BUFFER_QUEUE_MAX 4096
 
 #define printf(...) // comment this out to get lots of info printed
 
@@ -54,12 +63,18 @@ struct hid_struct {
 	uint8_t buffer[BUFFER_SIZE];
 	buffer_t *first_buffer;
 	buffer_t *last_buffer;
+	int buffer_count;
 	struct hid_struct *prev;
 	struct hid_struct *next;
 };
+// a device opened by rawhid_handle_open, until rawhid_handle_adopt lists it
+struct rawhid_handle {
+	IOHIDDeviceRef ref;
+};
 struct buffer_struct {
 	struct buffer_struct *next;
 	uint32_t len;
+	double stamp; // arrival, CLOCK_MONOTONIC seconds
 	uint8_t buf[BUFFER_SIZE];
 };
 
@@ -68,11 +83,194 @@ static void add_hid(hid_t *);
 static hid_t * get_hid(int);
 static void free_all_hid(void);
 static void hid_close(hid_t *);
+static int add_device(IOHIDDeviceRef);
 static void attach_callback(void *, IOReturn, void *, IOHIDDeviceRef);
 static void detach_callback(void *, IOReturn, void *hid_mgr, IOHIDDeviceRef dev);
 static void timeout_callback(CFRunLoopTimerRef, void *);
 static void input_callback(void *, IOReturn, void *, IOHIDReportType,
 	 uint32_t, uint8_t *, CFIndex);
+static void wait_attach_callback(void *, IOReturn, void *, IOHIDDeviceRef);
+static CFMutableDictionaryRef matching_dict(int, int, int, int);
+static int device_int_property(IOHIDDeviceRef, CFStringRef);
+
+//  rawhid_enumerate - list matching devices without opening them
+//
+//    Inputs:
+//	list = array receiving the device descriptions
+//	max = size of list
+//	vid, pid, usage_page, usage = as for rawhid_open
+//    Output:
+//	number of devices written to list
+//
+//    Uses a private HID Manager and does not touch the list of opened
+//    devices, so it may be called from another thread.
+//
+int rawhid_enumerate(rawhid_devinfo_t *list, int max, int vid, int pid, int usage_page, int usage)
+{
+	IOHIDManagerRef mgr;
+	CFMutableDictionaryRef dict;
+	CFSetRef set;
+	CFIndex i, n;
+	IOHIDDeviceRef *devs;
+	int count = 0;
+
+	mgr = IOHIDManagerCreate(kCFAllocatorDefault, kIOHIDOptionsTypeNone);
+	if (!mgr) return 0;
+	dict = matching_dict(vid, pid, usage_page, usage);
+	IOHIDManagerSetDeviceMatching(mgr, dict);
+	if (dict) CFRelease(dict);
+	set = IOHIDManagerCopyDevices(mgr);
+	if (!set) {
+		CFRelease(mgr);
+		return 0;
+	}
+	n = CFSetGetCount(set);
+	devs = (IOHIDDeviceRef *)malloc(n * sizeof(IOHIDDeviceRef));
+	if (devs) {
+		CFSetGetValues(set, (const void **)devs);
+		for (i = 0; i < n && count < max; i++) {
+			rawhid_devinfo_t *d = list + count;
+			CFStringRef serial;
+			io_string_t path;
+
+			memset(d, 0, sizeof(*d));
+			d->vid = device_int_property(devs[i], CFSTR(kIOHIDVendorIDKey));
+			d->pid = device_int_property(devs[i], CFSTR(kIOHIDProductIDKey));
+			d->usage_page = device_int_property(devs[i], CFSTR(kIOHIDPrimaryUsagePageKey));
+			d->usage = device_int_property(devs[i], CFSTR(kIOHIDPrimaryUsageKey));
+			d->input_size = device_int_property(devs[i], CFSTR(kIOHIDMaxInputReportSizeKey));
+			d->output_size = device_int_property(devs[i], CFSTR(kIOHIDMaxOutputReportSizeKey));
+			serial = IOHIDDeviceGetProperty(devs[i], CFSTR(kIOHIDSerialNumberKey));
+			if (serial && CFGetTypeID(serial) == CFStringGetTypeID())
+				CFStringGetCString(serial, d->serial, sizeof(d->serial), kCFStringEncodingUTF8);
+			if (IORegistryEntryGetPath(IOHIDDeviceGetService(devs[i]), kIOServicePlane,
+				path) != KERN_SUCCESS) continue;
+			snprintf(d->path, sizeof(d->path), "%s", path);
+			count++;
+		}
+		free(devs);
+	}
+	CFRelease(set);
+	CFRelease(mgr);
+	return count;
+}
+
+
+//  rawhid_fd - there is no descriptor to poll, IOKit delivers reports
+//  through the run loop, so callers have to poll with rawhid_recv
+//
+int rawhid_fd(int num)
+{
+	return -1;
+}
+
+
+//  rawhid_open_path - open a single device by the path rawhid_enumerate gave
+//
+//    Inputs:
+//	path = IOService plane path of the device
+//    Output:
+//	1 if the device was opened as device 0, 0 otherwise
+//
+//    Unlike rawhid_open this does not spin the run loop waiting for
+//    the HID Manager to match every device.
+//
+int rawhid_open_path(const char *path)
+{
+	rawhid_handle_t *handle;
+
+	handle = rawhid_handle_open(path);
+	if (!handle) return 0;
+	return rawhid_handle_adopt(handle);
+}
+
+
+//  rawhid_handle_open - open a device without adding it to the list
+//
+//    Inputs:
+//	path = IOService plane path of the device
+//    Output:
+//	the opened device, or NULL
+//
+//    Does not schedule the device on a run loop or touch the list of
+//    opened devices, so it may be called from another thread.
+//
+rawhid_handle_t *rawhid_handle_open(const char *path)
+{
+	io_registry_entry_t service;
+	IOHIDDeviceRef dev;
+	rawhid_handle_t *handle;
+
+	service = IORegistryEntryFromPath(kIOMasterPortDefault, path);
+	if (service == MACH_PORT_NULL) return NULL;
+	dev = IOHIDDeviceCreate(kCFAllocatorDefault, service);
+	IOObjectRelease(service);
+	if (!dev) return NULL;
+	if (IOHIDDeviceOpen(dev, kIOHIDOptionsTypeNone) != kIOReturnSuccess) {
+		CFRelease(dev);
+		return NULL;
+	}
+	handle = (rawhid_handle_t *)malloc(sizeof(rawhid_handle_t));
+	if (!handle) {
+		IOHIDDeviceClose(dev, kIOHIDOptionsTypeNone);
+		CFRelease(dev);
+		return NULL;
+	}
+	handle->ref = dev;
+	return handle;
+}
+
+
+//  rawhid_handle_adopt - make an opened device device 0
+//
+//    Inputs:
+//	handle = what rawhid_handle_open gave, freed by this call
+//    Output:
+//	1 if the device is now device 0, 0 otherwise
+//
+//    Reports arrive through the calling thread's run loop, as for
+//    the devices rawhid_open opens.
+//
+int rawhid_handle_adopt(rawhid_handle_t *handle)
+{
+	IOHIDDeviceRef dev = handle->ref;
+
+	free(handle);
+	if (first_hid) free_all_hid();
+	// the device list keeps the reference if add_device accepted it
+	if (!add_device(dev)) {
+		IOHIDDeviceClose(dev, kIOHIDOptionsTypeNone);
+		CFRelease(dev);
+		return 0;
+	}
+	return 1;
+}
+
+
+//  rawhid_handle_close - close a device that was never adopted
+//
+//    Inputs:
+//	handle = what rawhid_handle_open gave, freed by this call
+//
+void rawhid_handle_close(rawhid_handle_t *handle)
+{
+	IOHIDDeviceClose(handle->ref, kIOHIDOptionsTypeNone);
+	CFRelease(handle->ref);
+	free(handle);
+}
+
+
+static int device_int_property(IOHIDDeviceRef dev, CFStringRef key)
+{
+	CFTypeRef ref;
+	int val = 0;
+
+	ref = IOHIDDeviceGetProperty(dev, key);
+	if (!ref || CFGetTypeID(ref) != CFNumberGetTypeID()) return 0;
+	CFNumberGetValue((CFNumberRef)ref, kCFNumberIntType, &val);
+	return val;
+}
+
 
 
 
@@ -100,6 +298,7 @@ int rawhid_recv(int num, void *buf, int len, int timeout)
 		if (len > b->len) len = b->len;
 		memcpy(buf, b->buf, len);
 		hid->first_buffer = b->next;
+		hid->buffer_count--;
 		free(b);
 		return len;
 	}
@@ -114,6 +313,7 @@ int rawhid_recv(int num, void *buf, int len, int timeout)
 			if (len > b->len) len = b->len;
 			memcpy(buf, b->buf, len);
 			hid->first_buffer = b->next;
+			hid->buffer_count--;
 			free(b);
 			ret = len;
 			break;
@@ -130,9 +330,54 @@ int rawhid_recv(int num, void *buf, int len, int timeout)
 	return ret;
 }
 
+//  rawhid_recv_batch - receive every packet that is waiting
+//    Inputs:
+//	num = device to receive from (zero based)
+//	buf = room for max_reports packets, RAWHID_REPORT_SIZE bytes apart
+//	max_reports = most packets to receive
+//	lengths = receives the size of each packet
+//	timestamps = receives the arrival time of each packet, or NULL
+//	timeout = time to wait for the first packet, in milliseconds
+//    Output:
+//	number of packets received, or -1 on error
+//
+//    Runs the run loop only until the reports IOKit already has are delivered,
+//    so unlike rawhid_recv no timer is created when nothing is waiting.
+//
+int rawhid_recv_batch(int num, void *buf, int max_reports, int *lengths, double *timestamps,
+	int timeout)
+{
+	hid_t *hid;
+	buffer_t *b;
+	int n = 0, i, r;
+
+	hid = get_hid(num);
+	if (!hid || !hid->open) return -1;
+	if (!hid->first_buffer) {
+		for (i = 0; i < BUFFER_QUEUE_MAX; i++) {
+			r = CFRunLoopRunInMode(kCFRunLoopDefaultMode, 0, true);
+			if (r != kCFRunLoopRunHandledSource && r != kCFRunLoopRunStopped) break;
+		}
+		if (!hid->first_buffer && hid->open && timeout > 0)
+			CFRunLoopRunInMode(kCFRunLoopDefaultMode, (double)timeout / 1000.0, true);
+	}
+	while (n < max_reports && (b = hid->first_buffer) != NULL) {
+		memcpy((uint8_t *)buf + n * RAWHID_REPORT_SIZE, b->buf, b->len);
+		lengths[n] = b->len;
+		if (timestamps) timestamps[n] = b->stamp;
+		hid->first_buffer = b->next;
+		hid->buffer_count--;
+		free(b);
+		n++;
+	}
+	if (!n && !hid->open) return -1;
+	return n;
+}
+
 static void input_callback(void *context, IOReturn ret, void *sender,
 	IOHIDReportType type, uint32_t id, uint8_t *data, CFIndex len)
 {
+	struct timespec ts;
 	buffer_t *n;
 	hid_t *hid;
 
@@ -140,11 +385,21 @@ static void input_callback(void *context, IOReturn ret, void *sender,
 	if (ret != kIOReturnSuccess || len < 1) return;
 	hid = context;
 	if (!hid || hid->ref != sender) return;
-	n = (buffer_t *)malloc(sizeof(buffer_t));
-	if (!n) return;
+	if (hid->buffer_count >= BUFFER_QUEUE_MAX && hid->first_buffer) {
+		// the caller has not drained us for BUFFER_QUEUE_MAX reports: reuse
+		// the oldest rather than growing without bound
+		n = hid->first_buffer;
+		hid->first_buffer = n->next;
+		hid->buffer_count--;
+	} else {
+		n = (buffer_t *)malloc(sizeof(buffer_t));
+		if (!n) return;
+	}
 	if (len > BUFFER_SIZE) len = BUFFER_SIZE;
 	memcpy(n->buf, data, len);
 	n->len = len;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	n->stamp = ts.tv_sec + ts.tv_nsec * 1e-9;
 	n->next = NULL;
 	if (!hid->first_buffer || !hid->last_buffer) {
 		hid->first_buffer = hid->last_buffer = n;
@@ -152,6 +407,7 @@ static void input_callback(void *context, IOReturn ret, void *sender,
 		hid->last_buffer->next = n;
 		hid->last_buffer = n;
 	}
+	hid->buffer_count++;
 	CFRunLoopStop(CFRunLoopGetCurrent());
 }
 
@@ -244,7 +500,6 @@ int rawhid_open(int max, int vid, int pid, int usage_page, int usage)
 {
         static IOHIDManagerRef hid_manager=NULL;
         CFMutableDictionaryRef dict;
-        CFNumberRef num;
         IOReturn ret;
 	hid_t *p;
 	int count=0;
@@ -263,29 +518,8 @@ int rawhid_open(int max, int vid, int pid, int usage_page, int usage)
 	}
 	if (vid > 0 || pid > 0 || usage_page > 0 || usage > 0) {
 		// Tell the HID Manager what type of devices we want
-        	dict = CFDictionaryCreateMutable(kCFAllocatorDefault, 0,
-                	&kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+		dict = matching_dict(vid, pid, usage_page, usage);
         	if (!dict) return 0;
-		if (vid > 0) {
-			num = CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &vid);
-			CFDictionarySetValue(dict, CFSTR(kIOHIDVendorIDKey), num);
-			CFRelease(num);
-		}
-		if (pid > 0) {
-			num = CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &pid);
-			CFDictionarySetValue(dict, CFSTR(kIOHIDProductIDKey), num);
-			CFRelease(num);
-		}
-		if (usage_page > 0) {
-			num = CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &usage_page);
-			CFDictionarySetValue(dict, CFSTR(kIOHIDPrimaryUsagePageKey), num);
-			CFRelease(num);
-		}
-		if (usage > 0) {
-			num = CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &usage);
-			CFDictionarySetValue(dict, CFSTR(kIOHIDPrimaryUsageKey), num);
-			CFRelease(num);
-		}
         	IOHIDManagerSetDeviceMatching(hid_manager, dict);
         	CFRelease(dict);
 	} else {
@@ -330,6 +564,92 @@ void rawhid_close(int num)
 }
 
 
+//  rawhid_wait_attach - wait for a matching device to be plugged in
+//
+//    Inputs:
+//	vid, pid, usage_page, usage = as for rawhid_open
+//	timeout = time to wait, in milliseconds
+//    Output:
+//	1 if a matching device is present, 0 on timeout, -1 on error
+//
+//    Uses a private HID Manager scheduled on the calling thread's run
+//    loop and does not touch the list of opened devices, so it may be
+//    called from another thread than the one using rawhid_recv/rawhid_send.
+//
+int rawhid_wait_attach(int vid, int pid, int usage_page, int usage, int timeout)
+{
+	IOHIDManagerRef mgr;
+	CFMutableDictionaryRef dict;
+	CFAbsoluteTime deadline;
+	int found = 0;
+
+	mgr = IOHIDManagerCreate(kCFAllocatorDefault, kIOHIDOptionsTypeNone);
+	if (!mgr) return -1;
+	dict = matching_dict(vid, pid, usage_page, usage);
+	IOHIDManagerSetDeviceMatching(mgr, dict);
+	if (dict) CFRelease(dict);
+	IOHIDManagerRegisterDeviceMatchingCallback(mgr, wait_attach_callback, &found);
+	IOHIDManagerScheduleWithRunLoop(mgr, CFRunLoopGetCurrent(), kCFRunLoopDefaultMode);
+	if (IOHIDManagerOpen(mgr, kIOHIDOptionsTypeNone) != kIOReturnSuccess) {
+		IOHIDManagerUnscheduleFromRunLoop(mgr, CFRunLoopGetCurrent(), kCFRunLoopDefaultMode);
+		CFRelease(mgr);
+		return -1;
+	}
+	// devices already present are reported by the first run of the loop
+	deadline = CFAbsoluteTimeGetCurrent() + (double)timeout / 1000.0;
+	while (!found) {
+		CFTimeInterval left = deadline - CFAbsoluteTimeGetCurrent();
+		if (left <= 0) break;
+		CFRunLoopRunInMode(kCFRunLoopDefaultMode, left, true);
+	}
+	IOHIDManagerUnscheduleFromRunLoop(mgr, CFRunLoopGetCurrent(), kCFRunLoopDefaultMode);
+	IOHIDManagerClose(mgr, kIOHIDOptionsTypeNone);
+	CFRelease(mgr);
+	return found;
+}
+
+
+static void wait_attach_callback(void *context, IOReturn r, void *hid_mgr, IOHIDDeviceRef dev)
+{
+	printf("wait attach callback\n");
+	*(int *)context = 1;
+	CFRunLoopStop(CFRunLoopGetCurrent());
+}
+
+
+static CFMutableDictionaryRef matching_dict(int vid, int pid, int usage_page, int usage)
+{
+	CFMutableDictionaryRef dict;
+	CFNumberRef num;
+
+	if (vid <= 0 && pid <= 0 && usage_page <= 0 && usage <= 0) return NULL;
+	dict = CFDictionaryCreateMutable(kCFAllocatorDefault, 0,
+		&kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+	if (!dict) return NULL;
+	if (vid > 0) {
+		num = CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &vid);
+		CFDictionarySetValue(dict, CFSTR(kIOHIDVendorIDKey), num);
+		CFRelease(num);
+	}
+	if (pid > 0) {
+		num = CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &pid);
+		CFDictionarySetValue(dict, CFSTR(kIOHIDProductIDKey), num);
+		CFRelease(num);
+	}
+	if (usage_page > 0) {
+		num = CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &usage_page);
+		CFDictionarySetValue(dict, CFSTR(kIOHIDPrimaryUsagePageKey), num);
+		CFRelease(num);
+	}
+	if (usage > 0) {
+		num = CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &usage);
+		CFDictionarySetValue(dict, CFSTR(kIOHIDPrimaryUsageKey), num);
+		CFRelease(num);
+	}
+	return dict;
+}
+
+
 static void add_hid(hid_t *h)
 {
 	if (!first_hid || !last_hid) {
@@ -394,12 +714,19 @@ static void detach_callback(void *context, IOReturn r, void *hid_mgr, IOHIDDevic
 
 static void attach_callback(void *context, IOReturn r, void *hid_mgr, IOHIDDeviceRef dev)
 {
-	struct hid_struct *h;
-
 	printf("attach callback\n");
 	if (IOHIDDeviceOpen(dev, kIOHIDOptionsTypeNone) != kIOReturnSuccess) return;
+	add_device(dev);
+}
+
+// lists an opened device and has its reports delivered to the
+// calling thread's run loop, returns 0 if it could not
+static int add_device(IOHIDDeviceRef dev)
+{
+	struct hid_struct *h;
+
 	h = (hid_t *)malloc(sizeof(hid_t));
-	if (!h) return;
+	if (!h) return 0;
 	memset(h, 0, sizeof(hid_t));
 	IOHIDDeviceScheduleWithRunLoop(dev, CFRunLoopGetCurrent(), kCFRunLoopDefaultMode);
 	IOHIDDeviceRegisterInputReportCallback(dev, h->buffer, sizeof(h->buffer),
@@ -407,6 +734,7 @@ static void attach_callback(void *context, IOReturn r, void *hid_mgr, IOHIDDevic
 	h->ref = dev;
 	h->open = 1;
 	add_hid(h);
+	return 1;
 }
 
 
@@ -0,0 +1,129 @@
+/* Simulated Raw HID devices, the "sim" backend of rawhid.c.
+ *
+ * A sim device needs no hardware: any vid/pid opens, and every report sent to it comes back
+ * as an input report, so patches can be built and tested with nothing plugged in. Each open
+ * device has its own loopback queue, and when that is full sim_send refuses the report like a
+ * busy endpoint would. Everything runs on the caller's thread; there is no descriptor to wait
+ * on, so rawhid.c polls sim devices with its clock.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "hid.h"
+
+#define SIM_MAX 16     // devices open at the same time
+#define SIM_QUEUE 256  // reports looped back but not yet received
+
+typedef struct sim_dev {
+	int open;
+	int head;
+	int count;
+	unsigned char frames[SIM_QUEUE][RAWHID_REPORT_SIZE];
+	int lens[SIM_QUEUE];
+	double stamps[SIM_QUEUE];
+} sim_dev_t;
+static sim_dev_t sim_devs[SIM_MAX];
+
+static sim_dev_t * sim_get(int num)
+{
+	if (num < 0 || num >= SIM_MAX || !sim_devs[num].open) return NULL;
+	return sim_devs + num;
+}
+
+static double sim_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//  sim_open - open a simulated device
+//
+//    Inputs:
+//	path, vid, pid, usage_page, usage = ignored, every device exists
+//    Output:
+//	device number, or -1 when all SIM_MAX are in use
+//
+static int sim_open(const char *path, int vid, int pid, int usage_page, int usage)
+{
+	int i;
+
+	for (i = 0; i < SIM_MAX; i++) {
+		if (sim_devs[i].open) continue;
+		sim_devs[i].open = 1;
+		sim_devs[i].head = 0;
+		sim_devs[i].count = 0;
+		return i;
+	}
+	return -1;
+}
+
+//  sim_recv_batch - receive the reports looped back so far
+//
+//    Output:
+//	number of reports copied, never waits, -1 if the device is not open
+//
+static int sim_recv_batch(int num, void *buf, int max_reports, int *lengths, double *timestamps,
+			  int timeout)
+{
+	sim_dev_t *dev = sim_get(num);
+	int n;
+
+	if (!dev) return -1;
+	for (n = 0; n < max_reports && dev->count; n++) {
+		memcpy((unsigned char *)buf + n * RAWHID_REPORT_SIZE, dev->frames[dev->head],
+		       RAWHID_REPORT_SIZE);
+		lengths[n] = dev->lens[dev->head];
+		if (timestamps) timestamps[n] = dev->stamps[dev->head];
+		dev->head = (dev->head + 1) % SIM_QUEUE;
+		dev->count--;
+	}
+	return n;
+}
+
+//  sim_send - loop a report back to the device's input
+//
+//    Output:
+//	number of bytes taken, 0 if the loopback queue is full, -1 if the device is not open
+//
+static int sim_send(int num, void *buf, int len, int timeout)
+{
+	sim_dev_t *dev = sim_get(num);
+	int tail;
+
+	if (!dev) return -1;
+	if (dev->count == SIM_QUEUE) return 0;
+	if (len > RAWHID_REPORT_SIZE) len = RAWHID_REPORT_SIZE;
+	tail = (dev->head + dev->count) % SIM_QUEUE;
+	memset(dev->frames[tail], 0, RAWHID_REPORT_SIZE);
+	memcpy(dev->frames[tail], buf, len);
+	dev->lens[tail] = len;
+	dev->stamps[tail] = sim_now();
+	dev->count++;
+	return len;
+}
+
+//  sim_close - close a simulated device, dropping what it still queued
+//
+static void sim_close(int num)
+{
+	sim_dev_t *dev = sim_get(num);
+
+	if (dev) dev->open = 0;
+}
+
+static const rawhid_backend_t rawhid_sim_backend = {
+	"sim",
+	RAWHID_CAP_MULTI,
+	sim_open,
+	sim_recv_batch,
+	sim_send,
+	sim_close,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
@@ -0,0 +1,441 @@
+/* io_uring read/write path for the Linux hidraw backend, included by hid_LINUX.hpp.
+ *
+ * Every open device gets a small ring with one multishot poll for POLLIN on the hidraw
+ * descriptor and URING_READS read buffers. Once the poll says reports are waiting, a read is
+ * queued into every free buffer and all of them go to the kernel with one io_uring_enter. The
+ * descriptor stays non-blocking, so each read completes while it is submitted, with a report
+ * or with -EAGAIN once the kernel queue is empty, and none is left waiting in the kernel: a
+ * read on a blocking descriptor would park an io-wq kernel thread, and a poll linked ahead of
+ * every read woke all of them for each report. rawhid_recv_batch takes the whole batch in one
+ * call. Writes are submitted on the same ring and waited for, so rawhid_send returns the
+ * kernel's result.
+ *
+ * The ring is set up with the raw system calls, liburing is not needed. When the kernel has no
+ * io_uring, or it is disabled, the device stays on the poll()/read() path. Set hid_use_uring to
+ * 0 before opening to force that path, e.g. for comparison.
+ */
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define URING_READS 8         // read buffers per device
+#define URING_ENTRIES 32      // the reads, the poll, a write, and the cancels on close
+#define URING_POLL_TAG 0x80   // user_data of the poll, reads use their buffer index
+#define URING_WRITE_TAG 0x100
+#define URING_WAKE_TAG 0x200  // cancels and wakeups, nothing to do on completion
+
+// buffer states
+#define URING_FREE 0
+#define URING_KERNEL 1 // a read into it is queued
+#define URING_READY 2  // holds a report not yet taken
+
+// older headers, the kernel tells with -EINVAL when it has no multishot poll
+#ifndef IORING_POLL_ADD_MULTI
+#define IORING_POLL_ADD_MULTI (1U << 0)
+#endif
+#ifndef IORING_CQE_F_MORE
+#define IORING_CQE_F_MORE (1U << 1)
+#endif
+
+static int hid_use_uring = 1;
+
+struct hid_uring {
+	int fd;
+	pthread_mutex_t lock; // rawhid_recv and rawhid_send may run on different threads
+	void *sq_ptr, *cq_ptr;
+	size_t sq_len, cq_len, sqes_len;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned queued;             // prepared but not yet submitted
+	int hidfd;
+	int error;                   // a read or write failed, the device is gone
+	int polling;                 // the poll is armed
+	int oneshot;                 // no multishot poll, it is armed again after every wakeup
+	int readable;                // the poll fired since reads were last queued
+	int inflight;                // reads queued, and of those that completed
+	int got, dry;                // how many returned a report, and if one found none
+	uint8_t rbuf[URING_READS][RAWHID_REPORT_SIZE];
+	int rstate[URING_READS];
+	int ready[URING_READS];      // completed read buffers, in completion order
+	int ready_len[URING_READS];
+	double ready_ts[URING_READS]; // when the completion was reaped
+	int ready_head, ready_count;
+	uint8_t wbuf[BUFFER_SIZE + 1];
+	int wbusy;                   // the write is queued
+	int wres;                    // and what it returned
+};
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+// takes the next free submission entry, the caller fills it in
+static struct io_uring_sqe * uring_sqe(struct hid_uring *r)
+{
+	unsigned tail = *r->sq_tail;
+	unsigned i;
+
+	if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) > *r->sq_mask) return NULL;
+	i = tail & *r->sq_mask;
+	r->sq_array[i] = i;
+	memset(&r->sqes[i], 0, sizeof(r->sqes[i]));
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	r->queued++;
+	return &r->sqes[i];
+}
+
+static int uring_submit(struct hid_uring *r)
+{
+	int n;
+
+	if (!r->queued) return 0;
+	n = uring_enter(r->fd, r->queued, 0, 0);
+	if (n < 0) return (errno == EAGAIN || errno == EINTR || errno == EBUSY) ? 0 : -1;
+	r->queued -= n;
+	return n;
+}
+
+// queues the read into buffer i
+static void uring_arm_read(struct hid_uring *r, int i)
+{
+	struct io_uring_sqe *sqe;
+
+	if (!(sqe = uring_sqe(r))) return;
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = r->hidfd;
+	sqe->addr = (uintptr_t)r->rbuf[i];
+	sqe->len = RAWHID_REPORT_SIZE;
+	sqe->off = (uint64_t)-1; // current position, hidraw has none
+	sqe->user_data = i;
+	r->rstate[i] = URING_KERNEL;
+	r->inflight++;
+}
+
+// queues the poll that tells when reports are waiting, one completion per wakeup
+static void uring_arm_poll(struct hid_uring *r)
+{
+	struct io_uring_sqe *sqe;
+
+	if (!(sqe = uring_sqe(r))) return;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = r->hidfd;
+	sqe->poll_events = POLLIN;
+	sqe->len = r->oneshot ? 0 : IORING_POLL_ADD_MULTI;
+	sqe->user_data = URING_POLL_TAG;
+	r->polling = 1;
+}
+
+// queues a read into every free buffer when the poll fired, or when the last reads all
+// returned a report and more may be waiting, and re-arms the poll if it ended
+static void uring_refill(struct hid_uring *r)
+{
+	int i, n = 0;
+
+	if (r->error) return;
+	if (!r->polling) {
+		uring_arm_poll(r);
+		r->readable = 1; // reports may have come while it was not armed
+	}
+	if (r->inflight) return;
+	if (r->got && !r->dry) r->readable = 1;
+	r->got = r->dry = 0;
+	if (!r->readable) return;
+	for (i = 0; i < URING_READS; i++) {
+		if (r->rstate[i] != URING_FREE) continue;
+		uring_arm_read(r, i);
+		n++;
+	}
+	// with every buffer still holding a report, try again once one is taken
+	if (n) r->readable = 0;
+}
+
+// moves every completion out of the ring: reports to the ready list, stamped with the time
+// they were reaped, and the write's result. Returns how many were for the reads or the poll.
+static int uring_harvest(struct hid_uring *r)
+{
+	unsigned head = *r->cq_head;
+	unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+	double now = 0;
+	int n = 0;
+
+	for (; head != tail; head++) {
+		struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+		uint64_t tag = cqe->user_data;
+		int res = cqe->res;
+		if (tag == URING_WAKE_TAG) continue;
+		if (tag == URING_WRITE_TAG) {
+			r->wbusy = 0;
+			r->wres = res;
+			if (res < 0 && res != -EAGAIN && res != -EINTR) r->error = 1;
+			continue;
+		}
+		n++;
+		if (tag == URING_POLL_TAG) {
+			if (!(cqe->flags & IORING_CQE_F_MORE)) r->polling = 0;
+			if (res == -EINVAL && !r->oneshot) {
+				r->oneshot = 1;
+			} else if (res < 0 && res != -ECANCELED) {
+				r->error = 1;
+			} else if (res > 0) {
+				r->readable = 1;
+			}
+			continue;
+		}
+		r->inflight--;
+		if (res > 0) {
+			int slot = (r->ready_head + r->ready_count) % URING_READS;
+			if (!now) now = hid_now();
+			r->rstate[tag] = URING_READY;
+			r->ready[slot] = (int)tag;
+			r->ready_len[slot] = res;
+			r->ready_ts[slot] = now;
+			r->ready_count++;
+			r->got++;
+			continue;
+		}
+		r->rstate[tag] = URING_FREE;
+		if (res == -EAGAIN || res == -EINTR) {
+			r->dry = 1;
+		} else if (res != -ECANCELED) {
+			printf("uring read error %d\n", res);
+			r->error = 1;
+		}
+	}
+	__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+	return n;
+}
+
+// queues what there is to queue and picks up the reads, which complete while submitted
+static void uring_update(struct hid_uring *r)
+{
+	uring_harvest(r);
+	uring_refill(r);
+	if (uring_submit(r) > 0) uring_harvest(r);
+}
+
+// takes the oldest report off the ready list, its buffer is free again
+static int uring_take(struct hid_uring *r, void *buf, int len, double *stamp)
+{
+	int i = r->ready[r->ready_head];
+
+	if (len > r->ready_len[r->ready_head]) len = r->ready_len[r->ready_head];
+	memcpy(buf, r->rbuf[i], len);
+	if (stamp) *stamp = r->ready_ts[r->ready_head];
+	r->rstate[i] = URING_FREE;
+	r->ready_head = (r->ready_head + 1) % URING_READS;
+	r->ready_count--;
+	return len;
+}
+
+static void uring_free(struct hid_uring *r)
+{
+	if (r->sqes) munmap(r->sqes, r->sqes_len);
+	if (r->cq_ptr && r->cq_ptr != r->sq_ptr) munmap(r->cq_ptr, r->cq_len);
+	if (r->sq_ptr) munmap(r->sq_ptr, r->sq_len);
+	if (r->fd >= 0) close(r->fd);
+	pthread_mutex_destroy(&r->lock);
+	free(r);
+}
+
+// sets up a ring for an open hidraw descriptor and queues the poll, NULL if io_uring is
+// not available
+static struct hid_uring * hid_uring_open(int hidfd)
+{
+	struct io_uring_params p;
+	struct hid_uring *r;
+
+	if (!hid_use_uring) return NULL;
+	r = (struct hid_uring *)calloc(1, sizeof(*r));
+	if (!r) return NULL;
+	pthread_mutex_init(&r->lock, NULL);
+	memset(&p, 0, sizeof(p));
+	r->fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if (r->fd < 0) {
+		printf("io_uring_setup failed %d, using read()\n", errno);
+		r->fd = -1;
+		uring_free(r);
+		return NULL;
+	}
+	r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_len > r->sq_len) r->sq_len = r->cq_len;
+		r->cq_len = r->sq_len;
+	}
+	r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ptr == MAP_FAILED) {
+		r->sq_ptr = NULL;
+		uring_free(r);
+		return NULL;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		r->cq_ptr = r->sq_ptr;
+	} else {
+		r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if (r->cq_ptr == MAP_FAILED) {
+			r->cq_ptr = NULL;
+			uring_free(r);
+			return NULL;
+		}
+	}
+	r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = (struct io_uring_sqe *)mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) {
+		r->sqes = NULL;
+		uring_free(r);
+		return NULL;
+	}
+	r->sq_head = (unsigned *)((char *)r->sq_ptr + p.sq_off.head);
+	r->sq_tail = (unsigned *)((char *)r->sq_ptr + p.sq_off.tail);
+	r->sq_mask = (unsigned *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *)((char *)r->sq_ptr + p.sq_off.array);
+	r->cq_head = (unsigned *)((char *)r->cq_ptr + p.cq_off.head);
+	r->cq_tail = (unsigned *)((char *)r->cq_ptr + p.cq_off.tail);
+	r->cq_mask = (unsigned *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+	r->hidfd = hidfd;
+	uring_refill(r);
+	if (uring_submit(r) < 0) {
+		uring_free(r);
+		return NULL;
+	}
+	return r;
+}
+
+// cancels the poll and anything still queued, and waits until the kernel gave all buffers back
+static void hid_uring_close(struct hid_uring *r)
+{
+	struct io_uring_sqe *sqe;
+	int i, tries;
+
+	pthread_mutex_lock(&r->lock);
+	for (i = -2; i < URING_READS; i++) {
+		if (i == -2 ? !r->polling : i == -1 ? !r->wbusy : r->rstate[i] != URING_KERNEL)
+			continue;
+		if (!(sqe = uring_sqe(r))) break;
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = i == -2 ? URING_POLL_TAG : i == -1 ? URING_WRITE_TAG : i;
+		sqe->user_data = URING_WAKE_TAG;
+	}
+	uring_submit(r);
+	for (tries = 0; tries < 100; tries++) {
+		uring_harvest(r);
+		if (!r->polling && !r->inflight && !r->wbusy) break;
+		uring_enter(r->fd, 0, 1, IORING_ENTER_GETEVENTS);
+	}
+	pthread_mutex_unlock(&r->lock);
+	uring_free(r);
+}
+
+static int hid_uring_recv(struct hid_uring *r, void *buf, int len, int timeout)
+{
+	struct pollfd pfd;
+
+	pthread_mutex_lock(&r->lock);
+	if (!r->ready_count) uring_update(r);
+	if (!r->ready_count && !r->error && timeout != 0) {
+		pthread_mutex_unlock(&r->lock);
+		pfd.fd = r->fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		poll(&pfd, 1, timeout);
+		pthread_mutex_lock(&r->lock);
+		uring_update(r);
+	}
+	if (!r->ready_count) {
+		len = r->error ? -1 : 0;
+		pthread_mutex_unlock(&r->lock);
+		return len;
+	}
+	len = uring_take(r, buf, len, NULL);
+	pthread_mutex_unlock(&r->lock);
+	return len;
+}
+
+// copies out the reports that are ready, queueing reads again each time they run out
+static int hid_uring_recv_batch(struct hid_uring *r, void *buf, int max_reports, int *lengths,
+	double *timestamps, int timeout)
+{
+	struct pollfd pfd;
+	int n = 0, error;
+
+	pthread_mutex_lock(&r->lock);
+	if (!r->ready_count) uring_update(r);
+	if (!r->ready_count && !r->error && timeout != 0) {
+		pthread_mutex_unlock(&r->lock);
+		pfd.fd = r->fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		poll(&pfd, 1, timeout);
+		pthread_mutex_lock(&r->lock);
+		uring_update(r);
+	}
+	while (n < max_reports) {
+		if (!r->ready_count) {
+			uring_update(r);
+			if (!r->ready_count) break;
+		}
+		lengths[n] = uring_take(r, (uint8_t *)buf + n * RAWHID_REPORT_SIZE,
+			RAWHID_REPORT_SIZE, timestamps ? timestamps + n : NULL);
+		n++;
+	}
+	error = r->error;
+	pthread_mutex_unlock(&r->lock);
+	return (!n && error) ? -1 : n;
+}
+
+// writes the report with a zero report ID prefix and waits for its completion; returns what
+// rawhid_send does, 0 while another write is still queued
+static int hid_uring_send(struct hid_uring *r, void *buf, int len)
+{
+	struct io_uring_sqe *sqe;
+	int moved = 0, ret;
+
+	pthread_mutex_lock(&r->lock);
+	if (r->error || r->wbusy || !(sqe = uring_sqe(r))) {
+		ret = r->error ? -1 : 0;
+		pthread_mutex_unlock(&r->lock);
+		return ret;
+	}
+	r->wbuf[0] = 0;
+	memcpy(r->wbuf + 1, buf, len);
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = r->hidfd;
+	sqe->addr = (uintptr_t)r->wbuf;
+	sqe->len = len + 1;
+	sqe->off = (uint64_t)-1;
+	sqe->user_data = URING_WRITE_TAG;
+	r->wbusy = 1;
+	if (uring_submit(r) < 0) {
+		r->wbusy = 0;
+		r->error = 1;
+	}
+	// hidraw writes complete while submitted, but another thread may reap the completion
+	while (r->wbusy && !r->error) {
+		moved += uring_harvest(r);
+		if (!r->wbusy) break;
+		pthread_mutex_unlock(&r->lock);
+		uring_enter(r->fd, 0, 1, IORING_ENTER_GETEVENTS);
+		pthread_mutex_lock(&r->lock);
+	}
+	// we took completions the receiving side waits for on the ring, so leave it one
+	if (moved && (sqe = uring_sqe(r))) {
+		sqe->opcode = IORING_OP_NOP;
+		sqe->user_data = URING_WAKE_TAG;
+		uring_submit(r);
+	}
+	if (r->wbusy || r->error) ret = -1;
+	else if (r->wres > 0) ret = r->wres - 1;
+	else ret = (r->wres == -EAGAIN || r->wres == -EINTR || !r->wres) ? 0 : -1;
+	pthread_mutex_unlock(&r->lock);
+	return ret;
+}
@@ -17,16 +17,54 @@
 #include "hid.h"
 #include "m_pd.h"
 #include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 
+/* The platform's own device layer is the native backend, the first one registered. */
 #if defined(OS_CYGWIN) || defined(OS_MINGW)
 #include "hid_WINDOWS.hpp"
+#define RAWHID_NATIVE "windows"
+#define RAWHID_NATIVE_CAPS RAWHID_CAP_HOTPLUG
 #elif defined(OS_linux) || defined(OS_GNU) || defined(OS_kFreeBSD)
 #include "hid_LINUX.hpp"
+#define RAWHID_NATIVE "hidraw"
+#define RAWHID_NATIVE_CAPS (RAWHID_CAP_FD | RAWHID_CAP_HOTPLUG)
 #elif defined(OS_macosx)
 #include "hid_MACOSX.hpp"
+#define RAWHID_NATIVE "iokit"
+#define RAWHID_NATIVE_CAPS RAWHID_CAP_HOTPLUG
+#else
+#define RAWHID_NATIVE "native"
+#define RAWHID_NATIVE_CAPS (RAWHID_CAP_FD | RAWHID_CAP_HOTPLUG)
+#endif
+#include "hid_SIM.hpp"
+#include "rawhid_crc.hpp"
+#include "rawhid_layout.hpp"
+#include "rawhid_port.h"
+#include "rawhid_simd.hpp"
+#include "rawhid_trace.hpp"
+
+/* On Linux one I/O thread waits on every open device with epoll, instead of Pd polling each. */
+#if defined(OS_linux) && !defined(RAWHID_EPOLL)
+#define RAWHID_EPOLL 1
+#endif
+#if RAWHID_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sched.h>
+
+/* from Pd's s_stuff.h, which m_pd.h does not declare */
+typedef void (*t_fdpollfn)(void *ptr, int fd);
+EXTERN void sys_addpollfn(int fd, t_fdpollfn fn, void *ptr);
+EXTERN void sys_rmpollfn(int fd);
 #endif
 
 //#define DEBUG
@@ -40,16 +78,279 @@
 	#define DEBUG_DUMP(b, l, m) do { } while (0)
 #endif
 
-#define BLOCK_SIZE 64
 #define RAWHID_BUF_SIZE 16384
+#define RAWHID_MAX_IDS 256
+#define RAWHID_MSG_MAX 4096 /* longest message reassembled from framed reports */
+#define RAWHID_FRAME_CONT 0x80 /* framing header: continues the message of the previous report */
+#define RAWHID_FRAME_MORE 0x40 /* another report of this message follows */
+#define RAWHID_FRAME_LEN 0x3F  /* bytes of the message in this report */
+#define RAWHID_USAGE_PAGE 0xFFAB
+#define RAWHID_USAGE 0x0200
+#define RAWHID_WATCH_SLICE 100 /* ms the hotplug watcher blocks before checking for shutdown */
+#define RAWHID_MAX_DEVICES 32
+#define RAWHID_ENUM_INTERVAL 1000 /* ms between background rescans of the device cache */
+#define RAWHID_TXQ_MIN 16
+#define RAWHID_TXQ_MAX 4096 /* reports; beyond this the transmit queue drops */
+#define RAWHID_TX_RETRY 1   /* ms before retrying when the backend did not take a report */
+#define RAWHID_LANE_RT 0    /* 'list': time-critical reports, always sent first */
+#define RAWHID_LANE_BULK 1  /* 'bulk' and 'sendtable': sent only when the rt lane is empty */
+#define RAWHID_LANES 2
+#define RAWHID_RXQ_DEFAULT 64 /* inbound reports buffered per device, as many as hidraw keeps */
+#define RAWHID_RXQ_MAX 4096
+#if defined(BUFFER_QUEUE_MAX) && BUFFER_QUEUE_MAX < RAWHID_RXQ_MAX
+#error "the backend would drop reports before the inbound queue's policy sees them"
+#endif
+#define RAWHID_IO_SLOTS 32 /* devices the I/O thread serves */
+#define RAWHID_IO_RING 256 /* reports between the I/O thread and Pd, a power of two */
+#define RAWHID_IO_BATCH 16 /* epoll events taken per wakeup */
+#define RAWHID_IO_PROBE (RAWHID_IO_SLOTS + 1) /* epoll tag of the latency probe timer */
+#define RAWHID_LAT_BUCKETS 16 /* log2 microsecond buckets of the wakeup latency histogram */
+#define RAWHID_RECV_BATCH 32 /* reports asked of the backend per recv_batch call */
+#define RAWHID_MAX_BACKENDS 8
+#define RAWHID_LOG_RING 128      /* recent log events kept for 'log' */
+#define RAWHID_LOG_BURST 5       /* messages a call site may log at once, */
+#define RAWHID_LOG_INTERVAL 1000 /* then one per this many ms */
+#define RAWHID_SEQ_MAX 255      /* sequence IDs 1..255 can be in flight, 0 is never used */
+#define RAWHID_REQ_TIMEOUT 1000 /* default ms before a request without reply times out */
 
 /* declare rawhid_class as a t_class type */
 static t_class *rawhid_class;
 
+/* bound to RAWHID_PORT, [rawhid_out~] queues its reports through it */
+static t_class *rawhid_port_class;
+static t_pd *rawhid_port;
+
+/* Log severities. They are Pd's console levels, so its verbosity setting filters them too. */
+enum {
+	RAWHID_LOG_ERROR = 1,
+	RAWHID_LOG_WARN = 2,
+	RAWHID_LOG_INFO = 3,
+	RAWHID_LOG_DEBUG = 4
+};
+
+/* Rate limit of one logging call site, a token bucket refilled in logical time. */
+typedef struct _rawhid_logsite {
+	int 		l_init;
+	double 		l_refill; /* logical time of the last refill */
+	double 		l_tokens;
+	unsigned long 	l_suppressed; /* since the last message that got through */
+} t_rawhid_logsite;
+
+typedef struct _rawhid_logentry {
+	double 		e_time; /* logical time */
+	int 		e_level;
+	char 		e_text[120];
+} t_rawhid_logentry;
+
+/* Recent events of all instances, written on the Pd thread only. */
+static t_rawhid_logentry rawhid_log_ring[RAWHID_LOG_RING];
+static unsigned long rawhid_log_count = 0; /* events ever written */
+static unsigned long rawhid_log_suppressed = 0;
+
+/* Logs from a call site with its own rate limit. A message over the limit only costs a counter
+   increment, and the next one that gets through tells how many were suppressed. */
+#define RAWHID_LOG(obj, level, ...)                                                         \
+	do {                                                                                \
+		static t_rawhid_logsite rawhid_logsite_;                                    \
+		if (rawhid_log_admit(&rawhid_logsite_))                                     \
+			rawhid_log(&rawhid_logsite_, obj, level, __VA_ARGS__);              \
+	} while (0)
+
+typedef struct _rawhid t_rawhid;
+
+/* Growable ring of outbound reports, each stamped with the logical time it was queued. */
+typedef struct _rawhid_txq {
+	unsigned char (*q_frames)[RAWHID_BLOCK_SIZE];
+	double *	q_stamps;
+	int 		q_size;
+	int 		q_head;
+	int 		q_count;
+	unsigned long 	q_sent;
+	unsigned long 	q_dropped;
+	double 		q_latency_sum; /* ms spent queued, over all sent reports */
+	double 		q_latency_max;
+} t_rawhid_txq;
+
+/* What the inbound queue does with a report that arrives while it is full. */
+enum {
+	RAWHID_RX_DROP_OLDEST, /* make room by discarding the oldest report */
+	RAWHID_RX_DROP_NEWEST, /* discard the arriving report */
+	RAWHID_RX_KEEP_LATEST  /* replace a queued report with the same ID in place, else drop oldest */
+};
+
+/* Bounded ring of inbound reports. q_slot maps a report ID to its queued slot + 1 for the
+   keep-latest policy, which keeps at most one report per ID. */
+typedef struct _rawhid_rxq {
+	unsigned char (*q_frames)[RAWHID_REPORT_SIZE];
+	unsigned char *	q_lens;
+	double *	q_stamps; /* arrival, CLOCK_MONOTONIC seconds */
+	int 		q_size;
+	int 		q_head;
+	int 		q_count;
+	int 		q_policy;
+	unsigned short 	q_slot[RAWHID_MAX_IDS];
+	unsigned long 	q_received;
+	unsigned long 	q_dropped;
+	unsigned long 	q_replaced;
+} t_rawhid_rxq;
+
+/* Single-producer single-consumer ring from the I/O thread to the Pd thread. The indices only
+   grow; each side writes its own with release ordering, so no lock is taken per report. */
+typedef struct _rawhid_ring {
+	unsigned char 	r_frames[RAWHID_IO_RING][RAWHID_REPORT_SIZE];
+	unsigned char 	r_lens[RAWHID_IO_RING];
+	double 		r_stamps[RAWHID_IO_RING];
+	unsigned int 	r_head;    /* advanced by the Pd thread */
+	unsigned int 	r_tail;    /* advanced by the I/O thread */
+	unsigned long 	r_dropped; /* reports the I/O thread found no room for */
+} t_rawhid_ring;
+
+/* A request in flight, indexed by its sequence ID. */
+typedef struct _rawhid_req {
+	t_rawhid *	r_owner;  /* NULL when the sequence ID is free */
+	double 		r_sent;   /* real time in seconds, for the round trip */
+	double 		r_queued; /* logical time, for the timeout */
+	double 		r_timeout;
+} t_rawhid_req;
+
+#define RAWHID_SHADOW_RETRY 10 /* ms before dirty reports the transmit queue refused are retried */
+
+/* Shadow of one outbound report: what the patch wants and what was last queued for the device. */
+typedef struct _rawhid_shadow {
+	unsigned char 	s_state[RAWHID_BLOCK_SIZE];
+	unsigned char 	s_sent[RAWHID_BLOCK_SIZE];
+	int 		s_valid; /* s_sent is known to be on the device */
+	int 		s_dirty; /* listed in x_dirty until the next flush */
+} t_rawhid_shadow;
+
+/* Follows a device's sequence counter at one stage of the inbound path. c_seen has bit k set
+   when counter value c_next - 1 - k was seen, which tells duplicates from late reports. */
+typedef struct _rawhid_seqtrack {
+	int 		c_valid;
+	uint32_t 	c_next; /* value expected next */
+	uint64_t 	c_seen;
+	unsigned long 	c_received;
+	unsigned long 	c_lost; /* skipped values, less those that turned up late */
+	unsigned long 	c_dup;
+	unsigned long 	c_reorder;
+} t_rawhid_seqtrack;
+
+/* How 'decimate' summarises a field over its window. */
+enum {
+	RAWHID_DEC_MEAN,
+	RAWHID_DEC_MIN,
+	RAWHID_DEC_MAX,
+	RAWHID_DEC_LAST,
+	RAWHID_DEC_SMOOTH /* one-pole lowpass, sampled at the end of the window */
+};
+
+/* The fields 'decode' reads from inbound reports of one ID, and their window so far. */
+typedef struct _rawhid_decoder {
+	t_rawhid_template d_layout; /* as parsed for 'template', shorter reports are dropped */
+	int 		d_count; /* reports in the current window */
+	int 		d_primed; /* d_acc holds the lowpass state */
+	double 		d_acc[RAWHID_BLOCK_SIZE];
+} t_rawhid_decoder;
+
+/* What an offline hub shares with the thread that waits for its device. The hub and the thread
+   each hold a reference and whichever lets go last frees it, so the Pd thread never waits for the
+   watcher to finish. */
+typedef struct _rawhid_watch {
+	pthread_mutex_t w_lock;
+	const rawhid_backend_t *w_backend;
+	int 		w_vid;
+	int 		w_pid;
+	char 		w_serial[64];
+	rawhid_handle_t *w_handle; /* the device reopened, for the Pd thread to adopt */
+	int 		w_stop; /* the hub stopped waiting */
+	int 		w_refs;
+} t_rawhid_watch;
+
+/* One hub per open physical device. It owns the backend device and its poll clock, and fans every
+   received report out to the [rawhid] instances subscribed to it. */
+typedef struct _rawhid_hub {
+	int 		h_vid;
+	int 		h_pid;
+	char 		h_serial[64];
+	const rawhid_backend_t *h_backend;
+	int 		h_num; /* backend device index */
+	int 		h_refcount;
+	int 		h_dispatching;
+	int 		h_dead; /* closed while dispatching, freed at the end of the tick */
+	int 		h_online;
+	t_rawhid_watch *h_watch; /* while offline, the thread waiting for the device */
+	t_rawhid *	h_subs;
+	t_clock *	h_clock;
+	double 		h_deltime;
+	size_t 		h_packets_to_recv;
+	unsigned char 	h_inbuf[RAWHID_REPORT_SIZE];
+	unsigned char 	h_batch[RAWHID_RECV_BATCH][RAWHID_REPORT_SIZE];
+	int 		h_batchlen[RAWHID_RECV_BATCH];
+	double 		h_batchts[RAWHID_RECV_BATCH];
+	t_rawhid_rxq 	h_rxq;
+	/* I/O thread: while h_ioslot >= 0 it reads the device and h_ioclock dispatches */
+	int 		h_ioslot;
+	int 		h_ioerror; /* set by the I/O thread when the device went away */
+	t_clock *	h_ioclock;
+	t_rawhid_ring 	h_ring;
+	/* transmit scheduler: a token bucket paces reports out of the lanes, rt before bulk */
+	t_rawhid_txq 	h_txq[RAWHID_LANES];
+	t_clock *	h_txclock;
+	double 		h_txrate;  /* reports per second, 0 for as fast as the backend accepts */
+	double 		h_txburst; /* bucket depth in reports */
+	double 		h_tokens;
+	double 		h_txlast;  /* logical time of the last refill */
+	/* requests in flight: replies carry the sequence ID at byte h_seqpos */
+	t_rawhid_req 	h_req[RAWHID_SEQ_MAX + 1];
+	int 		h_nreq;
+	int 		h_seq; /* last sequence ID handed out */
+	int 		h_seqpos;
+	/* device sequence counter, checked on arrival and again on dispatch */
+	int 		h_seqoff; /* -1 when not checked */
+	int 		h_seqsize;
+	int 		h_seqbig;
+	t_rawhid_seqtrack h_seqrx; /* written by the I/O thread while it serves the hub */
+	t_rawhid_seqtrack h_seqout;
+	/* CRC check of inbound reports, the checksum stored at h_crcoff covers the bytes before it */
+	t_rawhid_crc *	h_crc; /* NULL when not checked */
+	int 		h_crcoff;
+	int 		h_crcbig;
+	int 		h_crcflag; /* output failed reports after a crcfail instead of dropping them */
+	unsigned long 	h_crcchecked;
+	unsigned long 	h_crcfailed;
+	/* framing: a header byte at h_frameoff, after a prefix every report of a message repeats */
+	int 		h_frameoff; /* -1 when reports are not framed */
+	int 		h_msgopen; /* h_msg holds the start of a message whose reports still arrive */
+	int 		h_msglen;
+	unsigned char 	h_msg[RAWHID_MSG_MAX];
+	t_clock *	h_reqclock;
+	struct _rawhid_hub *h_next;
+} t_rawhid_hub;
+
+static t_rawhid_hub *rawhid_hubs = NULL;
+
+/* Device backends registered at setup; an instance picks one with 'backend'. */
+static const rawhid_backend_t *rawhid_backends[RAWHID_MAX_BACKENDS];
+static int rawhid_nbackends = 0;
+
+/* Matching devices, rescanned by a background thread so that neither 'devices' nor 'open' has to
+   enumerate on the Pd thread. The thread runs while at least one [rawhid] exists. */
+static pthread_mutex_t rawhid_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rawhid_cache_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t rawhid_cache_thread;
+static int rawhid_cache_users = 0;
+static int rawhid_cache_stop = 0;
+static int rawhid_cache_valid = 0; /* set after the first scan completed */
+static int rawhid_cache_count = 0;
+static rawhid_devinfo_t rawhid_cache_devs[RAWHID_MAX_DEVICES];
+
 /* this struct is the 'handle' the Pd core will have to the instance. The
    rawhid_new method initializes it with a pointer to this instance */
-typedef struct _rawhid {
+struct _rawhid {
 	t_object 	x_obj;
+	t_rawhid_hub *	x_hub;
+	t_rawhid *	x_next_sub;
+	const rawhid_backend_t *x_backend; /* used by the next 'open' */
 	t_int 		x_brandId;
 	t_int 		x_productId;
 	t_int 		x_isOpen;
@@ -57,8 +358,46 @@ typedef struct _rawhid {
 	t_int 		x_packetSizeBytes;
 	t_int 		x_packetsBuf;
 	t_outlet *	x_data_outlet;
-	unsigned char 	x_buf[BLOCK_SIZE];
-	t_clock *	x_clock;
+	t_outlet *	x_info_outlet;
+	t_outlet *	x_resp_outlet; /* replies to 'request', rightmost */
+	t_int 		x_reconnect;
+	double 		x_txrate;
+	double 		x_txburst;
+	t_int 		x_rxsize;
+	t_int 		x_rxpolicy;
+	t_int 		x_listmode; /* output each report as one list instead of one float per byte */
+	t_int 		x_seqpos;
+	t_int 		x_seqoff;
+	t_int 		x_seqsize;
+	t_int 		x_seqbig;
+	t_int 		x_crcwidth; /* 0 when not checked */
+	uint32_t 	x_crcpoly;
+	uint32_t 	x_crcinit;
+	uint32_t 	x_crcxorout;
+	t_int 		x_crcrefl;
+	t_int 		x_crcoff;
+	t_int 		x_crcbig;
+	t_int 		x_crcflag;
+	t_int 		x_frameoff;
+	double 		x_reqtimeout;
+	/* shadow output: sparse updates, flushed once per logical tick */
+	t_rawhid_shadow *x_shadow[RAWHID_MAX_IDS]; /* allocated on first use */
+	unsigned char 	x_dirty[RAWHID_MAX_IDS];
+	t_int 		x_ndirty;
+	t_int 		x_deltacmd; /* report ID of the device's delta command, -1 for full reports */
+	t_clock *	x_shadowclock;
+	t_rawhid_template *x_templates[RAWHID_MAX_IDS]; /* allocated by 'template' */
+	t_rawhid_decoder *x_decoders[RAWHID_MAX_IDS];   /* allocated by 'decode' */
+	t_int 		x_decwindow; /* reports per decoded output */
+	t_int 		x_decmode;
+	double 		x_decalpha; /* coefficient of RAWHID_DEC_SMOOTH */
+	t_atom *	x_outatoms; /* grows to the longest report or message output */
+	int 		x_outsize;
+	t_outlet *	x_route[RAWHID_MAX_IDS]; /* report ID -> outlet, NULL if not subscribed */
+	t_int 		x_nroutes;
+	unsigned char 	x_accept[RAWHID_MAX_IDS]; /* per-subscriber report ID filter */
+	t_int 		x_naccept;
+	unsigned char 	x_buf[RAWHID_BLOCK_SIZE];
 	double 		x_deltime;
 	unsigned char *	x_inbuf;
 	unsigned char *	x_outbuf;
@@ -66,232 +405,2809 @@ typedef struct _rawhid {
 	size_t 		x_outbuf_len;
 	size_t 		x_outbuf_wr_index; /* offset to next free location in x_outbuf */
 	size_t 		x_packets_to_recv;
-} t_rawhid;
+};
 
 static void 	rawhid_close_device(t_rawhid *x);
-static void 	rawhid_tick(t_rawhid *x);
+static void 	rawhid_hub_tick(t_rawhid_hub *h);
+static void 	rawhid_hub_update(t_rawhid_hub *h);
+static void 	rawhid_hub_close(t_rawhid_hub *h);
+static void 	rawhid_hub_offline(t_rawhid_hub *h);
+static void 	rawhid_hub_event(t_rawhid_hub *h, t_rawhid *only, const char *event);
+static void 	rawhid_watch_unref(t_rawhid_watch *w);
+static void * 	rawhid_hub_watch(void *arg);
+static void 	rawhid_hub_watch_start(t_rawhid_hub *h);
+static void 	rawhid_hub_watch_stop(t_rawhid_hub *h);
+static void 	rawhid_hub_watch_poll(t_rawhid_hub *h);
+static int 	rawhid_txq_push(t_rawhid_txq *q, unsigned char *frame);
+static unsigned char *rawhid_txq_front(t_rawhid_txq *q);
+static void 	rawhid_txq_pop(t_rawhid_txq *q);
+static void 	rawhid_txq_free(t_rawhid_txq *q);
+static void 	rawhid_hub_tx(t_rawhid_hub *h);
+static void 	rawhid_rxq_init(t_rawhid_rxq *q, int size, int policy);
+static void 	rawhid_rxq_push(t_rawhid_rxq *q, unsigned char *buf, int len, double stamp);
+static int 	rawhid_rxq_pop(t_rawhid_rxq *q, unsigned char *buf, double *stamp);
+static void 	rawhid_rxq_free(t_rawhid_rxq *q);
+static size_t 	rawhid_hub_dispatch(t_rawhid_hub *h, size_t max);
+static void 	rawhid_hub_ioready(t_rawhid_hub *h);
+static int 	rawhid_io_register(t_rawhid_hub *h);
+static void 	rawhid_io_unregister(t_rawhid_hub *h);
+static int 	rawhid_hub_reply(t_rawhid_hub *h, unsigned char *buf, int len);
+static void 	rawhid_hub_reqtimeout(t_rawhid_hub *h);
+static void 	rawhid_hub_reqschedule(t_rawhid_hub *h);
+static int 	rawhid_hub_subscribe(t_rawhid *x, int vid, int pid, const char *serial);
+static void 	rawhid_hub_setcrc(t_rawhid_hub *h, t_rawhid *x);
+static int 	rawhid_hub_open_backend(t_rawhid_hub *h);
+static void * 	rawhid_cache_scan(void *arg);
+static void 	rawhid_cache_acquire(void);
+static void 	rawhid_cache_release(void);
+static int 	rawhid_cache_lookup(int vid, int pid, const char *serial, rawhid_devinfo_t *info);
+static void 	rawhid_cache_list(t_rawhid *x);
+static void 	rawhid_hub_unsubscribe(t_rawhid *x);
+static void 	rawhid_output_report(t_rawhid *x, unsigned char *buf, int len);
 static int  	write_serial(t_rawhid *x, unsigned char serial_byte);
-static int  	write_serials(t_rawhid *x, unsigned char *serial_buf, size_t buf_length);
+static int  	write_frame(t_rawhid *x, unsigned char *frame, int lane);
 static void 	rawhid_float(t_rawhid *x, t_float f);
 static void 	rawhid_list(t_rawhid *x, t_symbol *s, int argc, t_atom *argv);
+static void 	rawhid_bulk(t_rawhid *x, t_symbol *s, int argc, t_atom *argv);
 static void 	rawhid_close_device(t_rawhid *x);
-static void  	rawhid_open_device(t_rawhid *x, t_symbol *brandId, t_symbol *productId);
+static void  	rawhid_open_device(t_rawhid *x, t_symbol *s, int argc, t_atom *argv);
 static void   	rawhid_poll(t_rawhid *x, t_float poll);
 static void   	rawhid_packets(t_rawhid *x, t_float pockets);
-static void * 	rawhid_new(void);
+static void   	rawhid_reconnect(t_rawhid *x, t_float on);
+static void   	rawhid_listmode(t_rawhid *x, t_float on);
+static void   	rawhid_txrate(t_rawhid *x, t_float rate, t_float burst);
+static void   	rawhid_txstat(t_rawhid *x);
+static void   	rawhid_rxqueue(t_rawhid *x, t_symbol *s, int argc, t_atom *argv);
+static void   	rawhid_rxstat(t_rawhid *x);
+static void   	rawhid_rtprio(t_rawhid *x, t_symbol *s, int argc, t_atom *argv);
+static void   	rawhid_affinity(t_rawhid *x, t_symbol *s, int argc, t_atom *argv);
+static void   	rawhid_iolatency(t_rawhid *x, t_symbol *s, int argc, t_atom *argv);
+static void   	rawhid_request(t_rawhid *x, t_symbol *s, int argc, t_atom *argv);
+static void   	rawhid_seqpos(t_rawhid *x, t_float pos);
+static void   	rawhid_timeout(t_rawhid *x, t_float ms);
+static void   	rawhid_seqcheck(t_rawhid *x, t_symbol *s, int argc, t_atom *argv);
+static void   	rawhid_seqstat(t_rawhid *x);
+static void   	rawhid_crccheck(t_rawhid *x, t_symbol *s, int argc, t_atom *argv);
+static void   	rawhid_crcstat(t_rawhid *x);
+static void   	rawhid_framing(t_rawhid *x, t_symbol *s, int argc, t_atom *argv);
+static void   	rawhid_decode(t_rawhid *x, t_symbol *s, int argc, t_atom *argv);
+static void   	rawhid_decimate(t_rawhid *x, t_symbol *s, int argc, t_atom *argv);
+static void   	rawhid_decode_report(t_rawhid *x, t_rawhid_decoder *d, t_outlet *out,
+				     unsigned char *buf);
+static void   	rawhid_shadow(t_rawhid *x, t_symbol *s, int argc, t_atom *argv);
+static void   	rawhid_shadow_flush(t_rawhid *x);
+static void   	rawhid_shadow_resend(t_rawhid *x);
+static void   	rawhid_delta(t_rawhid *x, t_float cmd);
+static void   	rawhid_template(t_rawhid *x, t_symbol *s, int argc, t_atom *argv);
+static void   	rawhid_fire(t_rawhid *x, t_symbol *s, int argc, t_atom *argv);
+static void   	rawhid_sendtable(t_rawhid *x, t_symbol *name, t_float offset, t_float len);
+static void   	rawhid_filter(t_rawhid *x, t_symbol *s, int argc, t_atom *argv);
+static void   	rawhid_backend(t_rawhid *x, t_symbol *s, int argc, t_atom *argv);
+static void   	rawhid_logdump(t_rawhid *x, t_symbol *s, int argc, t_atom *argv);
+static void * 	rawhid_new(t_symbol *s, int argc, t_atom *argv);
 static void   	rawhid_free(t_rawhid *x);
 
 /* clang-format on */
 
-static void rawhid_tick(t_rawhid *x)
+static int rawhid_log_admit(t_rawhid_logsite *site)
 {
-	size_t recv_pakts = 0;
-	int recv_bytes = 0;
+	if (!site->l_init) {
+		site->l_init = 1;
+		site->l_tokens = RAWHID_LOG_BURST;
+	} else {
+		site->l_tokens += clock_gettimesince(site->l_refill) / RAWHID_LOG_INTERVAL;
+		if (site->l_tokens > RAWHID_LOG_BURST)
+			site->l_tokens = RAWHID_LOG_BURST;
+	}
+	site->l_refill = clock_getlogicaltime();
+	if (site->l_tokens < 1) {
+		site->l_suppressed++;
+		rawhid_log_suppressed++;
+		return 0;
+	}
+	site->l_tokens -= 1;
+	return 1;
+}
 
-	DEBUG_POST(("[rawhid] polling. reading up to %d packets", x->x_packets_to_recv));
+/* Formats the message into the ring and shows it on the console; use it through RAWHID_LOG. */
+static void rawhid_log(t_rawhid_logsite *site, const void *obj, int level, const char *fmt, ...)
+{
+	t_rawhid_logentry *e = &rawhid_log_ring[rawhid_log_count++ % RAWHID_LOG_RING];
+	size_t n;
+	va_list ap;
 
-	while (x->x_isOpen && recv_pakts < x->x_packets_to_recv) {
-		recv_bytes = rawhid_recv(0, x->x_inbuf, BLOCK_SIZE, 0);
-		// post("[rawhid] receive loop #%d", i);
+	va_start(ap, fmt);
+	vsnprintf(e->e_text, sizeof(e->e_text), fmt, ap);
+	va_end(ap);
+	if (site->l_suppressed) {
+		n = strlen(e->e_text);
+		snprintf(e->e_text + n, sizeof(e->e_text) - n, " (%lu more suppressed)",
+			 site->l_suppressed);
+		site->l_suppressed = 0;
+	}
+	e->e_time = clock_getlogicaltime();
+	e->e_level = level;
+	if (level == RAWHID_LOG_ERROR)
+		pd_error((void *)obj, "[rawhid] %s", e->e_text);
+	else
+		logpost(obj, level, "[rawhid] %s", e->e_text);
+}
 
-		if (recv_bytes > 0) {
-			int j = 0;
-			recv_pakts++;
-			DEBUG_POST(("[rawhid] %d° packet received: %d bytes", recv_pakts, recv_bytes));
-			for (j = 0; j < recv_bytes; j++) {
-				outlet_float(x->x_data_outlet, (t_float)x->x_inbuf[j]);
-			}
+/* Feeds one report to a sequence tracker. A counter that jumps back further than the window of
+   c_seen is taken as a device restart, and tracking starts over from it. */
+static void rawhid_seq_track(t_rawhid_seqtrack *c, t_rawhid_hub *h, unsigned char *buf, int len)
+{
+	uint32_t v = 0, d, mask;
+	int i;
 
-		} else if (recv_bytes < 0) {
-			post("[rawhid] error reading, device went offline");
-			rawhid_close_device(x);
-			break;
-		} else {
-			DEBUG_POST(("[rawhid] no packets to read"));
-			break;
-		}
+	if (h->h_seqoff < 0 || h->h_seqoff + h->h_seqsize > len)
+		return;
+	for (i = 0; i < h->h_seqsize; i++)
+		v |= (uint32_t)buf[h->h_seqoff + (h->h_seqbig ? h->h_seqsize - 1 - i : i)] << (8 * i);
+	mask = (h->h_seqsize == 4) ? 0xFFFFFFFF : (1u << (8 * h->h_seqsize)) - 1;
+	c->c_received++;
+	d = (v - c->c_next) & mask;
+	if (c->c_valid && d <= mask / 2) {
+		/* at or ahead of the expected value: d values were skipped */
+		c->c_lost += d;
+		c->c_seen = (d < 63) ? (c->c_seen << (d + 1)) | 1 : 1;
+		c->c_next = (v + 1) & mask;
+		return;
+	}
+	d = (c->c_next - 1 - v) & mask; /* behind the newest value */
+	if (!c->c_valid || d >= 64) {
+		c->c_valid = 1;
+		c->c_seen = 1;
+		c->c_next = (v + 1) & mask;
+	} else if ((c->c_seen >> d) & 1) {
+		c->c_dup++;
+	} else {
+		c->c_seen |= (uint64_t)1 << d;
+		c->c_reorder++;
+		if (c->c_lost)
+			c->c_lost--;
 	}
-	DEBUG_POST(("[rawhid] %i packets received. next polling in %.1f ms", recv_pakts, x->x_deltime));
-	clock_delay(x->x_clock, x->x_deltime);
 }
 
-static int write_serial(t_rawhid *x, unsigned char serial_byte)
+/* Checks the CRC of a report. A failure is counted and, when the hub flags instead of drops,
+   announced with "crcfail <stored> <computed>" on the info outlets; returns whether the report
+   is to be output. */
+static int rawhid_hub_crcok(t_rawhid_hub *h, unsigned char *buf, int len)
 {
-	if (!x->x_isOpen) {
-		post("[rawhid] No device open");
+	int size = h->h_crc->c_width / 8, off = h->h_crcoff, big = h->h_crcbig, i;
+	uint32_t stored = 0, crc = 0;
+	t_rawhid *sub, *next;
+	t_atom at[2];
+
+	h->h_crcchecked++;
+	if (off + size <= len) {
+		crc = rawhid_crc(h->h_crc, buf, off);
+		for (i = 0; i < size; i++)
+			stored |= (uint32_t)buf[off + (big ? size - 1 - i : i)] << (8 * i);
+		if (stored == crc)
+			return 1;
+	}
+	h->h_crcfailed++;
+	if (!h->h_crcflag)
 		return 0;
-	} else if (x->x_outbuf_wr_index < x->x_outbuf_len) {
-		DEBUG_POST(("[rawhid] Adding float to buffer"));
-		x->x_outbuf[x->x_outbuf_wr_index++] = serial_byte;
-		return 1;
+	/* a subscriber may change the check or close the hub in response */
+	SETFLOAT(at, stored);
+	SETFLOAT(at + 1, crc);
+	for (sub = h->h_subs; sub && !h->h_dead; sub = next) {
+		next = sub->x_next_sub;
+		outlet_anything(sub->x_info_outlet, gensym("crcfail"), 2, at);
 	}
-	/* handle overrun error */
-	post("[rawhid] buffer is full");
-	return 0;
+	return !h->h_dead;
 }
 
-static int write_serials(t_rawhid *x, unsigned char *buf, size_t buf_len)
+/* Adds a framed report to the message being reassembled. Returns the length of the message in
+   h_msg once its last report is in, 0 until then. A message whose start or tail went missing
+   is dropped. */
+static int rawhid_hub_reassemble(t_rawhid_hub *h, unsigned char *buf, int len)
 {
-	size_t bytes_to_send = buf_len;
+	int off = h->h_frameoff, n, cont;
 
-	if (!x->x_isOpen) {
-		post("[rawhid] Serial port is not open");
+	if (off >= len || off + 1 + (n = buf[off] & RAWHID_FRAME_LEN) > len) {
+		RAWHID_LOG(NULL, RAWHID_LOG_WARN, "dropping report with a bad framing header");
+		return h->h_msgopen = 0;
+	}
+	cont = buf[off] & RAWHID_FRAME_CONT;
+	if (cont && !h->h_msgopen) {
+		RAWHID_LOG(NULL, RAWHID_LOG_WARN, "dropping message whose first report was lost");
 		return 0;
 	}
+	if (!cont) {
+		if (h->h_msgopen)
+			RAWHID_LOG(NULL, RAWHID_LOG_WARN, "dropping message whose last report was lost");
+		memcpy(h->h_msg, buf, off);
+		h->h_msglen = off;
+	}
+	if (h->h_msglen + n > RAWHID_MSG_MAX) {
+		RAWHID_LOG(NULL, RAWHID_LOG_WARN, "dropping message longer than %d bytes",
+			   RAWHID_MSG_MAX);
+		return h->h_msgopen = 0;
+	}
+	memcpy(h->h_msg + h->h_msglen, buf + off + 1, n);
+	h->h_msglen += n;
+	h->h_msgopen = buf[off] & RAWHID_FRAME_MORE;
+	return h->h_msgopen ? 0 : h->h_msglen;
+}
+
+/* The native backend wraps the hid.h functions of the platform file included above. It has a
+   single device table, so its device number is always 0. */
+static int rawhid_native_open(const char *path, int vid, int pid, int usage_page, int usage)
+{
+	if (path)
+		return rawhid_open_path(path) > 0 ? 0 : -1;
+	return rawhid_open(1, vid, pid, usage_page, usage) > 0 ? 0 : -1;
+}
+
+static rawhid_handle_t *rawhid_native_attach(const char *path, int vid, int pid, int usage_page,
+					     int usage)
+{
+	rawhid_devinfo_t info;
+
+	if (!path) {
+		if (rawhid_enumerate(&info, 1, vid, pid, usage_page, usage) < 1)
+			return NULL;
+		path = info.path;
+	}
+	return rawhid_handle_open(path);
+}
+
+static int rawhid_native_adopt(rawhid_handle_t *handle)
+{
+	return rawhid_handle_adopt(handle) > 0 ? 0 : -1;
+}
+
+static const rawhid_backend_t rawhid_native_backend = {
+	RAWHID_NATIVE,
+	RAWHID_NATIVE_CAPS,
+	rawhid_native_open,
+	rawhid_recv_batch,
+	rawhid_send,
+	rawhid_close,
+	rawhid_fd,
+	rawhid_wait_attach,
+	rawhid_native_attach,
+	rawhid_native_adopt,
+	rawhid_handle_close
+};
+
+static void rawhid_backend_register(const rawhid_backend_t *b)
+{
+	if (rawhid_nbackends < RAWHID_MAX_BACKENDS)
+		rawhid_backends[rawhid_nbackends++] = b;
+}
+
+static const rawhid_backend_t *rawhid_backend_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < rawhid_nbackends; i++) {
+		if (!strcmp(rawhid_backends[i]->name, name))
+			return rawhid_backends[i];
+	}
+	return NULL;
+}
+
+static void rawhid_hub_tick(t_rawhid_hub *h)
+{
+	int got = 0, n, i;
 
-	/* if buf contains blocks of BLOCK_SIZE bytes, we send them entirely */
-	while (bytes_to_send >= BLOCK_SIZE) {
-		if (rawhid_send(0, buf, BLOCK_SIZE, 0) != BLOCK_SIZE) {
-			post("[rawhid] Error. Out buffer is full. Cannot send.");
-			return -1;
+	if (!h->h_online) {
+		h->h_dispatching = 1;
+		rawhid_hub_watch_poll(h);
+		h->h_dispatching = 0;
+		if (h->h_dead) {
+			clock_free(h->h_clock);
+			freebytes(h, sizeof(*h));
+			return;
 		}
-		bytes_to_send -= BLOCK_SIZE;
-		buf += BLOCK_SIZE;
+		clock_delay(h->h_clock, h->h_deltime);
+		return;
 	}
 
-	/* if less than BLOCK_SIZE bytes are still inthe buffer, then padding them and send */
-	if (bytes_to_send > 0) {
-		unsigned char padded_buf[BLOCK_SIZE];
-		memset(padded_buf, 0, BLOCK_SIZE);
-		memcpy(padded_buf, buf, bytes_to_send);
-		if (rawhid_send(0, padded_buf, BLOCK_SIZE, 0) != BLOCK_SIZE) {
-			post("[rawhid] Error. Out buffer is full. Could not send block.");
-			return -1;
+	if (h->h_ioslot >= 0)
+		return; /* the I/O thread wakes us when there is something to read */
+
+	DEBUG_POST(("[rawhid] polling. reading up to %d packets", h->h_packets_to_recv));
+
+	/* drain the backend into the inbound queue, whose policy decides what is kept */
+	for (n = 0; n < RAWHID_RXQ_MAX; n += got) {
+		got = h->h_backend->recv_batch(h->h_num, h->h_batch, RAWHID_RECV_BATCH,
+					       h->h_batchlen, h->h_batchts, 0);
+		for (i = 0; i < got; i++) {
+			RAWHID_TRACE4(rx_arrive, RAWHID_TRACE_DEV(h), h->h_batch[i][0],
+				      h->h_batchlen[i], RAWHID_TRACE_NS(h->h_batchts[i]));
+			rawhid_seq_track(&h->h_seqrx, h, h->h_batch[i], h->h_batchlen[i]);
+			rawhid_rxq_push(&h->h_rxq, h->h_batch[i], h->h_batchlen[i],
+					h->h_batchts[i]);
+			RAWHID_TRACE4(rx_enqueue, RAWHID_TRACE_DEV(h), h->h_batch[i][0],
+				      h->h_batchlen[i], RAWHID_TRACE_NS(h->h_batchts[i]));
 		}
+		if (got < RAWHID_RECV_BATCH)
+			break;
+	}
+
+	h->h_dispatching = 1;
+	rawhid_hub_dispatch(h, h->h_packets_to_recv);
+	if (!h->h_dead && got < 0) {
+		RAWHID_LOG(NULL, RAWHID_LOG_WARN, "error reading, device 0x%04x 0x%04x went offline",
+			   h->h_vid, h->h_pid);
+		rawhid_hub_offline(h);
 	}
-	return buf_len;
+	h->h_dispatching = 0;
+	if (h->h_dead) {
+		clock_free(h->h_clock);
+		freebytes(h, sizeof(*h));
+		return;
+	}
+	DEBUG_POST(("[rawhid] next polling in %.1f ms", h->h_deltime));
+	clock_delay(h->h_clock, h->h_deltime);
 }
 
-static void rawhid_float(t_rawhid *x, t_float f)
+/* Outputs up to max reports from the inbound queue, stopping early if a subscriber closed the
+   hub. The caller sets h_dispatching. */
+static size_t rawhid_hub_dispatch(t_rawhid_hub *h, size_t max)
 {
-	unsigned char serial_byte = ((int)f) & 0xFF; /* brutal conv */
+	size_t recv_pakts = 0;
+
+	while (!h->h_dead && recv_pakts < max) {
+		t_rawhid *sub, *next;
+		unsigned char *buf;
+		double stamp;
+		int len = rawhid_rxq_pop(&h->h_rxq, h->h_inbuf, &stamp);
+
+		if (!len) {
+			DEBUG_POST(("[rawhid] no packets to read"));
+			break;
+		}
+		recv_pakts++;
+		DEBUG_POST(("[rawhid] %d° packet received: %d bytes", recv_pakts, len));
+		RAWHID_TRACE4(rx_dequeue, RAWHID_TRACE_DEV(h), h->h_inbuf[0], len,
+			      RAWHID_TRACE_NS(stamp));
+		if (h->h_crc && !rawhid_hub_crcok(h, h->h_inbuf, len))
+			continue;
+		rawhid_seq_track(&h->h_seqout, h, h->h_inbuf, len);
+		if (h->h_nreq && rawhid_hub_reply(h, h->h_inbuf, len))
+			continue;
+		buf = h->h_inbuf;
+		if (h->h_frameoff >= 0) {
+			if (!(len = rawhid_hub_reassemble(h, h->h_inbuf, len)))
+				continue;
+			buf = h->h_msg;
+		}
+		for (sub = h->h_subs; sub; sub = next) {
+			next = sub->x_next_sub;
+			rawhid_output_report(sub, buf, len);
+		}
+		RAWHID_TRACE4(rx_deliver, RAWHID_TRACE_DEV(h), h->h_inbuf[0], len,
+			      RAWHID_TRACE_NS(stamp));
+	}
+	return recv_pakts;
+}
+
+/* Runs on the Pd thread once the I/O thread queued reports for this hub: moves them through the
+   inbound queue's overflow policy and outputs all of them. */
+static void rawhid_hub_ioready(t_rawhid_hub *h)
+{
+	t_rawhid_ring *ring = &h->h_ring;
+	unsigned int head = ring->r_head;
+	unsigned int tail = __atomic_load_n(&ring->r_tail, __ATOMIC_ACQUIRE);
+
+	for (; head != tail; head++) {
+		unsigned int i = head & (RAWHID_IO_RING - 1);
+		rawhid_rxq_push(&h->h_rxq, ring->r_frames[i], ring->r_lens[i], ring->r_stamps[i]);
+		RAWHID_TRACE4(rx_enqueue, RAWHID_TRACE_DEV(h), ring->r_frames[i][0], ring->r_lens[i],
+			      RAWHID_TRACE_NS(ring->r_stamps[i]));
+	}
+	__atomic_store_n(&ring->r_head, head, __ATOMIC_RELEASE);
+	h->h_rxq.q_dropped += __atomic_exchange_n(&ring->r_dropped, 0, __ATOMIC_ACQ_REL);
 
-	if (write_serial(x, serial_byte) != 1) {
-		post("Write error, maybe TX-OVERRUNS on serial line");
+	h->h_dispatching = 1;
+	rawhid_hub_dispatch(h, RAWHID_RXQ_MAX);
+	if (!h->h_dead && __atomic_load_n(&h->h_ioerror, __ATOMIC_ACQUIRE)) {
+		RAWHID_LOG(NULL, RAWHID_LOG_WARN, "error reading, device 0x%04x 0x%04x went offline",
+			   h->h_vid, h->h_pid);
+		rawhid_hub_offline(h);
+		if (!h->h_dead)
+			clock_delay(h->h_clock, h->h_deltime); /* back to polling the watcher */
+	}
+	h->h_dispatching = 0;
+	if (h->h_dead) {
+		clock_free(h->h_clock);
+		freebytes(h, sizeof(*h));
 	}
 }
 
-static void rawhid_list(t_rawhid *x, t_symbol *s, int argc, t_atom *argv)
+#if RAWHID_EPOLL
+/* The I/O thread and the devices it serves. rawhid_io_lock guards the slots and is held while the
+   thread reads, so a device can be taken away between two batches. Lock order is Pd, then io. */
+static pthread_mutex_t rawhid_io_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t rawhid_io_thread;
+static int rawhid_io_epfd = -1;
+static int rawhid_io_wakefd = -1; /* eventfd that interrupts epoll_wait for shutdown */
+static int rawhid_io_pdfd = -1; /* eventfd the thread writes and Pd polls, to hand over reports */
+static int rawhid_io_stop = 0;
+static int rawhid_io_count = 0;
+static struct {
+	t_rawhid_hub *	hub; /* NULL when the slot is free */
+	int 		fd;
+	int 		pending; /* has reports the Pd thread was not yet woken for */
+} rawhid_io_slots[RAWHID_IO_SLOTS];
+
+/* Scheduling of the I/O thread, set by 'rtprio' and 'affinity' and applied whenever it starts. */
+static int rawhid_io_prio = 0; /* 0 for the normal time-sharing scheduler */
+static int rawhid_io_policy = SCHED_FIFO;
+static int rawhid_io_pinned = 0;
+static cpu_set_t rawhid_io_cpus;
+
+/* Wakeup latency probe: a periodic timer in the epoll set, and how late the thread got to run
+   after each expiry. The thread fills the histogram with rawhid_io_lock held. */
+static int rawhid_io_timerfd = -1;
+static int rawhid_io_probe_ms = 0;
+static double rawhid_io_probe_next; /* CLOCK_MONOTONIC seconds of the next expiry */
+static unsigned long rawhid_io_hist[RAWHID_LAT_BUCKETS];
+static unsigned long rawhid_io_probes = 0;
+static double rawhid_io_latmax = 0; /* microseconds */
+
+static void rawhid_ring_push(t_rawhid_ring *ring, unsigned char *buf, int len, double stamp)
 {
-	unsigned char temp_array[RAWHID_BUF_SIZE]; /* arbitrary maximum list length */
-	int i, count;
-	int result;
+	unsigned int tail = ring->r_tail;
 
-	count = argc;
-	if (argc > RAWHID_BUF_SIZE) {
-		post("[rawhid] truncated list of %d elements to %d", argc, count);
-		count = RAWHID_BUF_SIZE;
+	if (tail - __atomic_load_n(&ring->r_head, __ATOMIC_ACQUIRE) == RAWHID_IO_RING) {
+		__atomic_add_fetch(&ring->r_dropped, 1, __ATOMIC_RELAXED);
+		return;
 	}
-	for (i = 0; i < count; i++){
-		temp_array[i] = ((unsigned char)atom_getint(argv + i)) & 0xFF; /* brutal conv */
-	}	
-	result = write_serials(x, temp_array, count);
+	memcpy(ring->r_frames[tail & (RAWHID_IO_RING - 1)], buf, len);
+	ring->r_lens[tail & (RAWHID_IO_RING - 1)] = len;
+	ring->r_stamps[tail & (RAWHID_IO_RING - 1)] = stamp;
+	__atomic_store_n(&ring->r_tail, tail + 1, __ATOMIC_RELEASE);
 }
 
-static void rawhid_open_device(t_rawhid *x, t_symbol *brandId, t_symbol *productId)
+/* Tells the Pd thread a batch is ready. The thread never takes the Pd lock: the scheduler polls
+   rawhid_io_pdfd and calls rawhid_io_ready from its own loop. */
+static void rawhid_io_wake(void)
 {
-	int bId = (int)strtol(brandId->s_name, NULL, 16);
-	int pId = (int)strtol(productId->s_name, NULL, 16);
-	if ((bId > 0) && (brandId->s_name[0] == '0') && (brandId->s_name[1] == 'x') && (pId > 0) &&
-	    (productId->s_name[0] == '0') && (productId->s_name[1] == 'x')) {
-		if (rawhid_open(1, bId, pId, 0xFFAB, 0x0200) > 0) {
-			post("[rawhid] Device %s %s open", brandId->s_name, productId->s_name);
-			x->x_brandId = bId;
-			x->x_productId = pId;
-			x->x_isOpen = 1;
-			clock_delay(x->x_clock, x->x_deltime);
-		} else {
-			post("[rawhid] Impossible to open device %s %s", brandId->s_name,
-			     productId->s_name);
+	uint64_t one = 1;
+
+	if (write(rawhid_io_pdfd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		DEBUG_POST(("[rawhid] could not wake the Pd thread"));
+}
+
+/* Runs on the Pd thread when rawhid_io_pdfd is readable: schedules every hub that got reports
+   since the last call. */
+static void rawhid_io_ready(void *dummy, int fd)
+{
+	uint64_t n;
+	int i;
+
+	if (read(fd, &n, sizeof(n)) < 0)
+		return;
+	pthread_mutex_lock(&rawhid_io_lock);
+	for (i = 0; i < RAWHID_IO_SLOTS; i++) {
+		if (rawhid_io_slots[i].pending && rawhid_io_slots[i].hub)
+			clock_delay(rawhid_io_slots[i].hub->h_ioclock, 0);
+		rawhid_io_slots[i].pending = 0;
+	}
+	pthread_mutex_unlock(&rawhid_io_lock);
+}
+
+static double rawhid_io_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Applies the priority and CPU set to the running I/O thread. Without the privilege for realtime
+   scheduling (CAP_SYS_NICE or an rtprio limit) it keeps running at normal priority. */
+static void rawhid_io_sched(void)
+{
+	struct sched_param sp;
+	cpu_set_t all;
+	int i, err;
+
+	memset(&sp, 0, sizeof(sp));
+	sp.sched_priority = rawhid_io_prio;
+	err = pthread_setschedparam(rawhid_io_thread, rawhid_io_prio ? rawhid_io_policy : SCHED_OTHER,
+				    &sp);
+	if (err)
+		post("[rawhid] I/O thread stays at normal priority: %s", strerror(err));
+	CPU_ZERO(&all);
+	for (i = 0; i < CPU_SETSIZE; i++)
+		CPU_SET(i, &all);
+	err = pthread_setaffinity_np(rawhid_io_thread, sizeof(cpu_set_t),
+				     rawhid_io_pinned ? &rawhid_io_cpus : &all);
+	if (err)
+		post("[rawhid] I/O thread could not be pinned: %s", strerror(err));
+}
+
+/* Starts the probe timer, or stops it when rawhid_io_probe_ms is 0. */
+static void rawhid_io_probe_arm(void)
+{
+	struct itimerspec its;
+	double next = 0;
+
+	memset(&its, 0, sizeof(its));
+	if (rawhid_io_probe_ms > 0) {
+		next = rawhid_io_now() + rawhid_io_probe_ms / 1000.0;
+		its.it_value.tv_sec = (time_t)next;
+		its.it_value.tv_nsec = (long)((next - (time_t)next) * 1e9);
+		its.it_interval.tv_sec = rawhid_io_probe_ms / 1000;
+		its.it_interval.tv_nsec = (rawhid_io_probe_ms % 1000) * 1000000L;
+	}
+	pthread_mutex_lock(&rawhid_io_lock);
+	rawhid_io_probe_next = next;
+	pthread_mutex_unlock(&rawhid_io_lock);
+	timerfd_settime(rawhid_io_timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/* The probe timer fired; called by the I/O thread with rawhid_io_lock held. */
+static void rawhid_io_probe(void)
+{
+	double period = rawhid_io_probe_ms / 1000.0, expiry, us;
+	uint64_t n;
+	int b;
+
+	if (read(rawhid_io_timerfd, &n, sizeof(n)) != sizeof(n) || !n || !rawhid_io_probe_next)
+		return;
+	/* when we were late by more than a period, the last of the n expiries counts */
+	expiry = rawhid_io_probe_next + (n - 1) * period;
+	rawhid_io_probe_next = expiry + period;
+	us = (rawhid_io_now() - expiry) * 1e6;
+	for (b = 0; b < RAWHID_LAT_BUCKETS - 1 && us >= (2 << b); b++)
+		;
+	rawhid_io_hist[b]++;
+	rawhid_io_probes++;
+	if (us > rawhid_io_latmax)
+		rawhid_io_latmax = us;
+}
+
+/* I/O thread: drains every ready device into its ring, then wakes Pd once for the batch. */
+static void *rawhid_io_run(void *arg)
+{
+	struct epoll_event ev[RAWHID_IO_BATCH];
+	unsigned char batch[RAWHID_RECV_BATCH][RAWHID_REPORT_SIZE];
+	int lens[RAWHID_RECV_BATCH];
+	double stamps[RAWHID_RECV_BATCH];
+	int i, j, k, n, got, woke;
+
+	while (!__atomic_load_n(&rawhid_io_stop, __ATOMIC_ACQUIRE)) {
+		n = epoll_wait(rawhid_io_epfd, ev, RAWHID_IO_BATCH, -1);
+		if (n < 0 && errno != EINTR)
+			break;
+		woke = 0;
+		pthread_mutex_lock(&rawhid_io_lock);
+		for (i = 0; i < n; i++) {
+			int slot = ev[i].data.u32;
+			t_rawhid_hub *h;
+			if (slot == RAWHID_IO_PROBE) {
+				rawhid_io_probe();
+				continue;
+			}
+			if (slot >= RAWHID_IO_SLOTS || !(h = rawhid_io_slots[slot].hub))
+				continue;
+			for (j = 0, got = 0; j < RAWHID_IO_RING; j += got) {
+				got = h->h_backend->recv_batch(h->h_num, batch, RAWHID_RECV_BATCH,
+							       lens, stamps, 0);
+				for (k = 0; k < got; k++) {
+					RAWHID_TRACE4(rx_arrive, RAWHID_TRACE_DEV(h), batch[k][0],
+						      lens[k], RAWHID_TRACE_NS(stamps[k]));
+					rawhid_seq_track(&h->h_seqrx, h, batch[k], lens[k]);
+					rawhid_ring_push(&h->h_ring, batch[k], lens[k], stamps[k]);
+				}
+				if (got < RAWHID_RECV_BATCH)
+					break;
+			}
+			if (got < 0) {
+				__atomic_store_n(&h->h_ioerror, 1, __ATOMIC_RELEASE);
+				epoll_ctl(rawhid_io_epfd, EPOLL_CTL_DEL, rawhid_io_slots[slot].fd, NULL);
+			}
+			rawhid_io_slots[slot].pending = 1;
+			woke = 1;
 		}
-	} else {
-		post("[rawhid] Invalid input for open operation. (e.g. open 0x002a 0x160c)",
-		     brandId->s_name, productId->s_name);
+		pthread_mutex_unlock(&rawhid_io_lock);
+		if (woke)
+			rawhid_io_wake();
 	}
+	return NULL;
 }
 
-static void rawhid_close_device(t_rawhid *x)
+static int rawhid_io_start(void)
 {
-	if (x->x_isOpen) {
-		rawhid_close(0);
-		x->x_isOpen = 0;
-		clock_unset(x->x_clock);
-		post("[rawhid] Device 0x%04x 0x%04x closed", x->x_brandId, x->x_productId);
-	} else {
-		post("[rawhid] There are no open devices to close.");
+	struct epoll_event ev;
+
+	if ((rawhid_io_epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		return 0;
+	if ((rawhid_io_wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) {
+		close(rawhid_io_epfd);
+		return 0;
+	}
+	if ((rawhid_io_pdfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) {
+		close(rawhid_io_wakefd);
+		close(rawhid_io_epfd);
+		return 0;
+	}
+	ev.events = EPOLLIN;
+	ev.data.u32 = RAWHID_IO_SLOTS;
+	epoll_ctl(rawhid_io_epfd, EPOLL_CTL_ADD, rawhid_io_wakefd, &ev);
+	/* without the probe timer 'iolatency' just has nothing to report */
+	if ((rawhid_io_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)) >= 0) {
+		ev.data.u32 = RAWHID_IO_PROBE;
+		epoll_ctl(rawhid_io_epfd, EPOLL_CTL_ADD, rawhid_io_timerfd, &ev);
 	}
+	rawhid_io_stop = 0;
+	if (pthread_create(&rawhid_io_thread, NULL, rawhid_io_run, NULL)) {
+		if (rawhid_io_timerfd >= 0)
+			close(rawhid_io_timerfd);
+		close(rawhid_io_pdfd);
+		close(rawhid_io_wakefd);
+		close(rawhid_io_epfd);
+		rawhid_io_timerfd = rawhid_io_pdfd = -1;
+		return 0;
+	}
+	sys_addpollfn(rawhid_io_pdfd, rawhid_io_ready, NULL);
+	if (rawhid_io_prio || rawhid_io_pinned)
+		rawhid_io_sched();
+	if (rawhid_io_probe_ms)
+		rawhid_io_probe_arm();
+	return 1;
 }
 
-static void rawhid_poll(t_rawhid *x, t_float poll)
+static void rawhid_io_shutdown(void)
 {
-	post("[rawhid] Polling set to %.01fms", poll);
-	x->x_deltime = poll;
+	uint64_t one = 1;
+
+	__atomic_store_n(&rawhid_io_stop, 1, __ATOMIC_RELEASE);
+	if (write(rawhid_io_wakefd, &one, sizeof(one)) < 0)
+		DEBUG_POST(("[rawhid] could not wake the I/O thread"));
+	pthread_join(rawhid_io_thread, NULL);
+	sys_rmpollfn(rawhid_io_pdfd);
+	if (rawhid_io_timerfd >= 0)
+		close(rawhid_io_timerfd);
+	close(rawhid_io_pdfd);
+	close(rawhid_io_wakefd);
+	close(rawhid_io_epfd);
+	rawhid_io_epfd = rawhid_io_wakefd = rawhid_io_timerfd = rawhid_io_pdfd = -1;
 }
 
-static void rawhid_packets(t_rawhid *x, t_float packets)
+/* Hands the hub's device to the I/O thread, starting it for the first device. Returns 0 when the
+   backend has no descriptor to wait on, and the hub keeps polling with its clock. */
+static int rawhid_io_register(t_rawhid_hub *h)
 {
-	x->x_packets_to_recv = (size_t)packets;
-	post("[rawhid] Packets to receive per poll set to %d", x->x_packets_to_recv);
+	struct epoll_event ev;
+	int i, fd = -1;
+
+	if (h->h_backend->caps & RAWHID_CAP_FD)
+		fd = h->h_backend->fd(h->h_num);
+
+	if (fd < 0 || (!rawhid_io_count && !rawhid_io_start()))
+		return 0;
+	pthread_mutex_lock(&rawhid_io_lock);
+	for (i = 0; i < RAWHID_IO_SLOTS && rawhid_io_slots[i].hub; i++)
+		;
+	h->h_ring.r_head = h->h_ring.r_tail = 0;
+	h->h_ioerror = 0;
+	ev.events = EPOLLIN;
+	ev.data.u32 = i;
+	if (i == RAWHID_IO_SLOTS || epoll_ctl(rawhid_io_epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		pthread_mutex_unlock(&rawhid_io_lock);
+		if (!rawhid_io_count)
+			rawhid_io_shutdown();
+		return 0;
+	}
+	rawhid_io_slots[i].hub = h;
+	rawhid_io_slots[i].fd = fd;
+	rawhid_io_slots[i].pending = 0;
+	rawhid_io_count++;
+	h->h_ioslot = i;
+	pthread_mutex_unlock(&rawhid_io_lock);
+	return 1;
 }
 
-/* the 'constructor' method which defines the t_rawhid struct for this
-   instance and returns it to the caller which is the Pd core */
-static void *rawhid_new(void)
+/* Takes the device away from the I/O thread; call it before the backend closes the device. */
+static void rawhid_io_unregister(t_rawhid_hub *h)
 {
-	post("[rawhid] Starting ...");
-	t_rawhid *x = (t_rawhid *)pd_new(rawhid_class);
+	if (h->h_ioslot < 0)
+		return;
+	pthread_mutex_lock(&rawhid_io_lock);
+	epoll_ctl(rawhid_io_epfd, EPOLL_CTL_DEL, rawhid_io_slots[h->h_ioslot].fd, NULL);
+	rawhid_io_slots[h->h_ioslot].hub = NULL;
+	rawhid_io_slots[h->h_ioslot].pending = 0;
+	rawhid_io_count--;
+	pthread_mutex_unlock(&rawhid_io_lock);
+	h->h_ioslot = -1;
+	clock_unset(h->h_ioclock);
+	if (!rawhid_io_count)
+		rawhid_io_shutdown();
+}
 
-	x->x_inbuf = getbytes(RAWHID_BUF_SIZE);
-	x->x_outbuf = getbytes(RAWHID_BUF_SIZE);
-	if (NULL == x->x_inbuf || NULL == x->x_outbuf) {
-		pd_error(x, "[rawhid] fatal error : unable to allocate buffer");
+/* Keeps the I/O thread away from the hub while the Pd thread touches what the thread writes. */
+static void rawhid_io_hold(t_rawhid_hub *h)
+{
+	if (h->h_ioslot >= 0)
+		pthread_mutex_lock(&rawhid_io_lock);
+}
+
+static void rawhid_io_release(t_rawhid_hub *h)
+{
+	if (h->h_ioslot >= 0)
+		pthread_mutex_unlock(&rawhid_io_lock);
+}
+#else
+static int rawhid_io_register(t_rawhid_hub *h)
+{
+	return 0;
+}
+
+static void rawhid_io_unregister(t_rawhid_hub *h)
+{
+}
+
+static void rawhid_io_hold(t_rawhid_hub *h)
+{
+}
+
+static void rawhid_io_release(t_rawhid_hub *h)
+{
+}
+#endif
+
+/* The hub polls as often as its most demanding subscriber asks for. */
+static void rawhid_hub_update(t_rawhid_hub *h)
+{
+	t_rawhid *sub;
+
+	h->h_deltime = 0;
+	h->h_packets_to_recv = 0;
+	for (sub = h->h_subs; sub; sub = sub->x_next_sub) {
+		if (sub == h->h_subs || sub->x_deltime < h->h_deltime)
+			h->h_deltime = sub->x_deltime;
+		if (sub->x_packets_to_recv > h->h_packets_to_recv)
+			h->h_packets_to_recv = sub->x_packets_to_recv;
+	}
+}
+
+/* Returns 0 if the device could not be opened. Otherwise x is subscribed, unless it closed again
+   in response to "connect", which leaves x_hub NULL. */
+static int rawhid_hub_subscribe(t_rawhid *x, int vid, int pid, const char *serial)
+{
+	const rawhid_backend_t *b = x->x_backend;
+	t_rawhid_hub *h, *next;
+	int dispatching;
+
+	for (h = rawhid_hubs; h; h = h->h_next) {
+		if (h->h_backend == b && h->h_vid == vid && h->h_pid == pid &&
+		    (!*serial || !strcmp(h->h_serial, serial)))
+			break;
+	}
+	if (!h) {
+		/* a backend without RAWHID_CAP_MULTI keeps a single device table, which open
+		   replaces */
+		for (h = rawhid_hubs; h && !(b->caps & RAWHID_CAP_MULTI); h = next) {
+			next = h->h_next;
+			if (h->h_backend != b)
+				continue;
+			post("[rawhid] closing device 0x%04x 0x%04x, only one %s device can be open",
+			     h->h_vid, h->h_pid, b->name);
+			rawhid_hub_close(h);
+		}
+		h = (t_rawhid_hub *)getbytes(sizeof(*h));
+		h->h_vid = vid;
+		h->h_pid = pid;
+		snprintf(h->h_serial, sizeof(h->h_serial), "%s", serial);
+		h->h_backend = b;
+		h->h_num = 0;
+		if (!rawhid_hub_open_backend(h)) {
+			freebytes(h, sizeof(*h));
+			return 0;
+		}
+		h->h_online = 1;
+		h->h_clock = clock_new(h, (t_method)rawhid_hub_tick);
+		h->h_ioclock = clock_new(h, (t_method)rawhid_hub_ioready);
+		h->h_ioslot = -1;
+		h->h_txclock = clock_new(h, (t_method)rawhid_hub_tx);
+		h->h_txrate = x->x_txrate;
+		h->h_txburst = x->x_txburst;
+		rawhid_rxq_init(&h->h_rxq, x->x_rxsize, x->x_rxpolicy);
+		h->h_tokens = h->h_txburst;
+		h->h_txlast = clock_getlogicaltime();
+		h->h_reqclock = clock_new(h, (t_method)rawhid_hub_reqtimeout);
+		h->h_seqpos = x->x_seqpos;
+		h->h_seqoff = x->x_seqoff;
+		h->h_seqsize = x->x_seqsize;
+		h->h_seqbig = x->x_seqbig;
+		rawhid_hub_setcrc(h, x);
+		h->h_frameoff = x->x_frameoff;
+		h->h_next = rawhid_hubs;
+		rawhid_hubs = h;
+		rawhid_io_register(h);
+		clock_delay(h->h_clock, 0);
+	}
+	x->x_hub = h;
+	x->x_next_sub = h->h_subs;
+	h->h_subs = x;
+	h->h_refcount++;
+	x->x_isOpen = h->h_online;
+	rawhid_hub_update(h);
+	if (!h->h_online)
 		return 1;
+	/* subscribing may happen while the hub dispatches, which then frees a closed hub itself */
+	dispatching = h->h_dispatching;
+	h->h_dispatching = 1;
+	rawhid_hub_event(h, x, "connect");
+	h->h_dispatching = dispatching;
+	if (h->h_dead && !dispatching) {
+		clock_free(h->h_clock);
+		freebytes(h, sizeof(*h));
 	}
-	x->x_inbuf_len = RAWHID_BUF_SIZE;
-	x->x_outbuf_len = RAWHID_BUF_SIZE;
-	x->x_outbuf_wr_index = 0;
-	x->x_data_outlet = outlet_new(&x->x_obj, &s_float);
-	x->x_packets_to_recv = 1; // default = 1
-	/* Since 10ms is also the default poll time for most HID devices,
-	 * and it seems that for most uses of [comport] (i.e. arduinos and
-	 * other serial ports 115200 baud or less) that 10ms polling is
-	 * going to give the data as fast as 1ms polling with a lot less
-	 * CPU time wasted. */
-	x->x_deltime = 1000;
-	x->x_clock = clock_new(x, (t_method)rawhid_tick);
-	post("[rawhid] Successfully started");
-	return (void *)x;
+	return 1;
 }
 
-static void rawhid_free(t_rawhid *x)
+/* Opens the hub's device by the path found in the cache, which takes constant time. Only when the
+   cache has no entry yet (e.g. it was just plugged in) do we fall back to a full enumeration.
+   The cache lists native devices; other backends open by vid and pid alone. */
+static int rawhid_hub_open_backend(t_rawhid_hub *h)
 {
-	post("[rawhid] free rawhid...");
-	clock_unset(x->x_clock);
-	clock_free(x->x_clock);
-	rawhid_close_device(x);
-	freebytes(x->x_inbuf, x->x_inbuf_len);
-	freebytes(x->x_outbuf, x->x_outbuf_len);
+	const rawhid_backend_t *b = h->h_backend;
+	rawhid_devinfo_t info;
+	int native = (b == &rawhid_native_backend);
+
+	if (native && rawhid_cache_lookup(h->h_vid, h->h_pid, h->h_serial, &info) > 0 &&
+	    (h->h_num = b->open(info.path, h->h_vid, h->h_pid, RAWHID_USAGE_PAGE,
+				RAWHID_USAGE)) >= 0)
+		return 1;
+	if (native && *h->h_serial)
+		return 0;
+	h->h_num = b->open(NULL, h->h_vid, h->h_pid, RAWHID_USAGE_PAGE, RAWHID_USAGE);
+	return h->h_num >= 0;
 }
 
-/* This method is the only one the Pd core expects to be present */
+/* Closes the backend device and detaches every subscriber. */
+static void rawhid_hub_close(t_rawhid_hub *h)
+{
+	t_rawhid_hub **hp;
+	t_rawhid *sub;
+	int i;
 
-#if defined(_LANGUAGE_C_PLUS_PLUS) || defined(__cplusplus)
-extern "C" {
-#endif
-void rawhid_setup(void)
+	for (sub = h->h_subs; sub; sub = sub->x_next_sub) {
+		sub->x_hub = NULL;
+		sub->x_isOpen = 0;
+	}
+	h->h_subs = NULL;
+	h->h_refcount = 0;
+	rawhid_hub_watch_stop(h);
+	for (hp = &rawhid_hubs; *hp; hp = &(*hp)->h_next) {
+		if (*hp == h) {
+			*hp = h->h_next;
+			break;
+		}
+	}
+	rawhid_io_unregister(h);
+	if (h->h_online)
+		h->h_backend->close(h->h_num);
+	clock_unset(h->h_clock);
+	clock_free(h->h_ioclock);
+	clock_free(h->h_txclock);
+	clock_free(h->h_reqclock);
+	for (i = 0; i < RAWHID_LANES; i++)
+		rawhid_txq_free(&h->h_txq[i]);
+	rawhid_rxq_free(&h->h_rxq);
+	if (h->h_crc)
+		freebytes(h->h_crc, sizeof(*h->h_crc));
+	h->h_crc = NULL;
+	if (h->h_dispatching) {
+		h->h_dead = 1;
+		return;
+	}
+	clock_free(h->h_clock);
+	freebytes(h, sizeof(*h));
+}
+
+/* Called when the device stops answering. Subscribers that asked for reconnect keep the hub alive
+   while a background thread waits for the device to come back; otherwise, or when the backend
+   cannot tell that it is back, it is closed. */
+static void rawhid_hub_offline(t_rawhid_hub *h)
 {
-	/* this registers the 'rawhid' class. The 'rawhid_new' method will be executed at each
-	instantiation. */
-	rawhid_class = class_new(gensym("rawhid"), (t_newmethod)rawhid_new, 0, sizeof(t_rawhid),
-				 CLASS_DEFAULT, 0);
+	t_rawhid *sub;
+	int reconnect = 0;
 
-	class_addfloat(rawhid_class, (t_method)rawhid_float);
-	class_addlist(rawhid_class, (t_method)rawhid_list);
-	class_addmethod(rawhid_class, (t_method)rawhid_open_device, gensym("open"), A_DEFSYM,
-			A_DEFSYM, 0);
-	class_addmethod(rawhid_class, (t_method)rawhid_poll, gensym("poll"), A_FLOAT, 0);
-	class_addmethod(rawhid_class, (t_method)rawhid_packets, gensym("packets"), A_FLOAT, 0);
-	class_addmethod(rawhid_class, (t_method)rawhid_close_device, gensym("close"), 0);
+	rawhid_hub_event(h, NULL, "disconnect");
+	for (sub = h->h_subs; sub; sub = sub->x_next_sub) {
+		reconnect |= sub->x_reconnect;
+	}
+	if (reconnect && !(h->h_backend->caps & RAWHID_CAP_HOTPLUG)) {
+		post("[rawhid] %s devices cannot be watched, not waiting for 0x%04x 0x%04x",
+		     h->h_backend->name, h->h_vid, h->h_pid);
+		reconnect = 0;
+	}
+	if (!reconnect) {
+		rawhid_hub_close(h);
+		return;
+	}
+	rawhid_io_unregister(h);
+	h->h_backend->close(h->h_num);
+	h->h_online = 0;
+	for (sub = h->h_subs; sub; sub = sub->x_next_sub) {
+		sub->x_isOpen = 0;
+	}
+	post("[rawhid] waiting for device 0x%04x 0x%04x to reconnect", h->h_vid, h->h_pid);
+	rawhid_hub_watch_start(h);
+}
+
+/* Outputs "<event> <vid> <pid>" on the info outlet of every subscriber, or only of 'only'. */
+static void rawhid_hub_event(t_rawhid_hub *h, t_rawhid *only, const char *event)
+{
+	t_rawhid *sub, *next;
+	t_atom at[2];
+
+	SETFLOAT(at, h->h_vid);
+	SETFLOAT(at + 1, h->h_pid);
+	for (sub = only ? only : h->h_subs; sub; sub = next) {
+		next = only ? NULL : sub->x_next_sub;
+		outlet_anything(sub->x_info_outlet, gensym(event), 2, at);
+	}
+}
+
+/* Drops one reference to w. It is allocated with malloc, as the watcher thread may free it. */
+static void rawhid_watch_unref(t_rawhid_watch *w)
+{
+	int refs;
+
+	pthread_mutex_lock(&w->w_lock);
+	refs = --w->w_refs;
+	pthread_mutex_unlock(&w->w_lock);
+	if (refs)
+		return;
+	pthread_mutex_destroy(&w->w_lock);
+	free(w);
+}
+
+/* Reopens the device w waits for. A native device with a serial number has to be the same one,
+   other backends open by vid and pid alone, as in rawhid_hub_open_backend. */
+static rawhid_handle_t *rawhid_watch_attach(t_rawhid_watch *w)
+{
+	rawhid_devinfo_t devs[RAWHID_MAX_DEVICES];
+	int i, n;
+
+	if (w->w_backend != &rawhid_native_backend || !*w->w_serial)
+		return w->w_backend->attach(NULL, w->w_vid, w->w_pid, RAWHID_USAGE_PAGE,
+					    RAWHID_USAGE);
+	n = rawhid_enumerate(devs, RAWHID_MAX_DEVICES, w->w_vid, w->w_pid, RAWHID_USAGE_PAGE,
+			     RAWHID_USAGE);
+	for (i = 0; i < n; i++) {
+		if (!strcmp(devs[i].serial, w->w_serial))
+			return w->w_backend->attach(devs[i].path, w->w_vid, w->w_pid,
+						    RAWHID_USAGE_PAGE, RAWHID_USAGE);
+	}
+	return NULL;
+}
+
+/* Hotplug watcher thread: blocks in the backend until the device shows up again, finds and opens
+   it, and leaves the handle for the Pd thread, which only adds it to the backend's tables. */
+static void *rawhid_hub_watch(void *arg)
+{
+	t_rawhid_watch *w = (t_rawhid_watch *)arg;
+	rawhid_handle_t *handle = NULL;
+	int stop = 0, found;
+
+	while (!stop && !handle) {
+		/* a device that is there but cannot be opened yet (udev may still be setting its
+		   permissions) is retried a slice later */
+		if ((found = w->w_backend->wait_attach(w->w_vid, w->w_pid, RAWHID_USAGE_PAGE,
+						       RAWHID_USAGE, RAWHID_WATCH_SLICE)) < 0 ||
+		    (found && !(handle = rawhid_watch_attach(w))))
+			usleep(RAWHID_WATCH_SLICE * 1000);
+		pthread_mutex_lock(&w->w_lock);
+		stop = w->w_stop;
+		if (!stop)
+			w->w_handle = handle;
+		pthread_mutex_unlock(&w->w_lock);
+	}
+	if (stop && handle)
+		w->w_backend->release(handle);
+	rawhid_watch_unref(w);
+	return NULL;
+}
+
+static void rawhid_hub_watch_start(t_rawhid_hub *h)
+{
+	t_rawhid_watch *w = (t_rawhid_watch *)calloc(1, sizeof(*w));
+	pthread_t tid;
+
+	if (!w) {
+		pd_error(NULL, "[rawhid] unable to start hotplug watcher");
+		return;
+	}
+	pthread_mutex_init(&w->w_lock, NULL);
+	w->w_backend = h->h_backend;
+	w->w_vid = h->h_vid;
+	w->w_pid = h->h_pid;
+	snprintf(w->w_serial, sizeof(w->w_serial), "%s", h->h_serial);
+	w->w_refs = 2;
+	if (pthread_create(&tid, NULL, rawhid_hub_watch, w) != 0) {
+		pd_error(NULL, "[rawhid] unable to start hotplug watcher");
+		pthread_mutex_destroy(&w->w_lock);
+		free(w);
+		return;
+	}
+	pthread_detach(tid);
+	h->h_watch = w;
+}
+
+/* Tells the watcher to quit at the end of its current slice, without waiting for it, and closes
+   a device it reopened that was not adopted. */
+static void rawhid_hub_watch_stop(t_rawhid_hub *h)
+{
+	t_rawhid_watch *w = h->h_watch;
+	rawhid_handle_t *handle;
+
+	if (!w)
+		return;
+	pthread_mutex_lock(&w->w_lock);
+	w->w_stop = 1;
+	handle = w->w_handle;
+	w->w_handle = NULL;
+	pthread_mutex_unlock(&w->w_lock);
+	if (handle)
+		h->h_backend->release(handle);
+	rawhid_watch_unref(w);
+	h->h_watch = NULL;
+}
+
+/* Runs on the Pd clock while the hub is offline and adopts the device once the watcher reopened
+   it. The caller sets h_dispatching, since a subscriber may close the hub in response to
+   "connect". */
+static void rawhid_hub_watch_poll(t_rawhid_hub *h)
+{
+	rawhid_handle_t *handle;
+	t_rawhid *sub;
+
+	if (!h->h_watch)
+		return;
+	pthread_mutex_lock(&h->h_watch->w_lock);
+	handle = h->h_watch->w_handle;
+	h->h_watch->w_handle = NULL;
+	pthread_mutex_unlock(&h->h_watch->w_lock);
+	if (!handle)
+		return;
+	rawhid_hub_watch_stop(h);
+	pthread_cond_signal(&rawhid_cache_wake);
+	if ((h->h_num = h->h_backend->adopt(handle)) < 0) {
+		rawhid_hub_watch_start(h);
+		return;
+	}
+	h->h_online = 1;
+	h->h_seqrx.c_valid = h->h_seqout.c_valid = 0; /* the device counter may have restarted */
+	h->h_msgopen = 0;
+	rawhid_io_register(h);
+	for (sub = h->h_subs; sub; sub = sub->x_next_sub) {
+		sub->x_isOpen = 1;
+	}
+	post("[rawhid] Device 0x%04x 0x%04x reconnected", h->h_vid, h->h_pid);
+	rawhid_hub_event(h, NULL, "connect");
+	if (!h->h_dead)
+		rawhid_hub_tx(h);
+}
+
+/* Queues a copy of frame. The ring doubles when full, up to RAWHID_TXQ_MAX reports; returns 0 if
+   the report had to be dropped. */
+static int rawhid_txq_push(t_rawhid_txq *q, unsigned char *frame)
+{
+	int tail;
+
+	if (q->q_count == q->q_size) {
+		int i, size = q->q_size ? 2 * q->q_size : RAWHID_TXQ_MIN;
+		unsigned char (*frames)[RAWHID_BLOCK_SIZE];
+		double *stamps;
+		if (size > RAWHID_TXQ_MAX) {
+			q->q_dropped++;
+			return 0;
+		}
+		frames = getbytes(size * sizeof(*frames));
+		stamps = getbytes(size * sizeof(*stamps));
+		for (i = 0; i < q->q_count; i++) {
+			int j = (q->q_head + i) % q->q_size;
+			memcpy(frames[i], q->q_frames[j], RAWHID_BLOCK_SIZE);
+			stamps[i] = q->q_stamps[j];
+		}
+		if (q->q_size) {
+			freebytes(q->q_frames, q->q_size * sizeof(*q->q_frames));
+			freebytes(q->q_stamps, q->q_size * sizeof(*q->q_stamps));
+		}
+		q->q_frames = frames;
+		q->q_stamps = stamps;
+		q->q_size = size;
+		q->q_head = 0;
+	}
+	tail = (q->q_head + q->q_count) % q->q_size;
+	memcpy(q->q_frames[tail], frame, RAWHID_BLOCK_SIZE);
+	q->q_stamps[tail] = clock_getlogicaltime();
+	q->q_count++;
+	return 1;
+}
+
+static unsigned char *rawhid_txq_front(t_rawhid_txq *q)
+{
+	return q->q_count ? q->q_frames[q->q_head] : NULL;
+}
+
+/* Removes the front report after it was sent, accounting for the time it spent queued. */
+static void rawhid_txq_pop(t_rawhid_txq *q)
+{
+	double latency = clock_gettimesince(q->q_stamps[q->q_head]);
+
+	q->q_head = (q->q_head + 1) % q->q_size;
+	q->q_count--;
+	q->q_sent++;
+	q->q_latency_sum += latency;
+	if (latency > q->q_latency_max)
+		q->q_latency_max = latency;
+}
+
+static void rawhid_txq_free(t_rawhid_txq *q)
+{
+	if (q->q_size) {
+		freebytes(q->q_frames, q->q_size * sizeof(*q->q_frames));
+		freebytes(q->q_stamps, q->q_size * sizeof(*q->q_stamps));
+	}
+	memset(q, 0, sizeof(*q));
+}
+
+/* (Re)sizes the inbound queue. Reports already queued are kept, newest first, as far as they
+   fit. */
+static void rawhid_rxq_init(t_rawhid_rxq *q, int size, int policy)
+{
+	unsigned char (*frames)[RAWHID_REPORT_SIZE] = getbytes(size * sizeof(*frames));
+	unsigned char *lens = getbytes(size);
+	double *stamps = getbytes(size * sizeof(*stamps));
+	int i, skip = (q->q_count > size) ? q->q_count - size : 0;
+
+	memset(q->q_slot, 0, sizeof(q->q_slot));
+	for (i = skip; i < q->q_count; i++) {
+		int j = (q->q_head + i) % q->q_size;
+		memcpy(frames[i - skip], q->q_frames[j], RAWHID_REPORT_SIZE);
+		lens[i - skip] = q->q_lens[j];
+		stamps[i - skip] = q->q_stamps[j];
+		q->q_slot[frames[i - skip][0]] = i - skip + 1;
+	}
+	q->q_dropped += skip;
+	q->q_count -= skip;
+	if (q->q_size) {
+		freebytes(q->q_frames, q->q_size * sizeof(*q->q_frames));
+		freebytes(q->q_lens, q->q_size);
+		freebytes(q->q_stamps, q->q_size * sizeof(*q->q_stamps));
+	}
+	q->q_frames = frames;
+	q->q_lens = lens;
+	q->q_stamps = stamps;
+	q->q_size = size;
+	q->q_head = 0;
+	q->q_policy = policy;
+}
+
+static void rawhid_rxq_push(t_rawhid_rxq *q, unsigned char *buf, int len, double stamp)
+{
+	int slot;
+
+	q->q_received++;
+	if (q->q_policy == RAWHID_RX_KEEP_LATEST && (slot = q->q_slot[buf[0]])) {
+		memcpy(q->q_frames[slot - 1], buf, len);
+		q->q_lens[slot - 1] = len;
+		q->q_stamps[slot - 1] = stamp;
+		q->q_replaced++;
+		return;
+	}
+	if (q->q_count == q->q_size) {
+		q->q_dropped++;
+		if (q->q_policy == RAWHID_RX_DROP_NEWEST)
+			return;
+		if (q->q_slot[q->q_frames[q->q_head][0]] == q->q_head + 1)
+			q->q_slot[q->q_frames[q->q_head][0]] = 0;
+		q->q_head = (q->q_head + 1) % q->q_size;
+		q->q_count--;
+	}
+	slot = (q->q_head + q->q_count) % q->q_size;
+	memcpy(q->q_frames[slot], buf, len);
+	q->q_lens[slot] = len;
+	q->q_stamps[slot] = stamp;
+	q->q_slot[buf[0]] = slot + 1;
+	q->q_count++;
+}
+
+/* Copies the oldest report to buf and returns its length, 0 when the queue is empty. */
+static int rawhid_rxq_pop(t_rawhid_rxq *q, unsigned char *buf, double *stamp)
+{
+	int len;
+
+	if (!q->q_count)
+		return 0;
+	len = q->q_lens[q->q_head];
+	*stamp = q->q_stamps[q->q_head];
+	memcpy(buf, q->q_frames[q->q_head], len);
+	if (q->q_slot[buf[0]] == q->q_head + 1)
+		q->q_slot[buf[0]] = 0;
+	q->q_head = (q->q_head + 1) % q->q_size;
+	q->q_count--;
+	return len;
+}
+
+static void rawhid_rxq_free(t_rawhid_rxq *q)
+{
+	if (q->q_size) {
+		freebytes(q->q_frames, q->q_size * sizeof(*q->q_frames));
+		freebytes(q->q_lens, q->q_size);
+		freebytes(q->q_stamps, q->q_size * sizeof(*q->q_stamps));
+	}
+	memset(q, 0, sizeof(*q));
+}
+
+/* The lane the next report is taken from: bulk reports only go out in slots the rt lane leaves
+   empty. Returns NULL when both lanes are empty. */
+static t_rawhid_txq *rawhid_hub_txlane(t_rawhid_hub *h)
+{
+	int i;
+
+	for (i = 0; i < RAWHID_LANES; i++) {
+		if (h->h_txq[i].q_count)
+			return &h->h_txq[i];
+	}
+	return NULL;
+}
+
+/* Transmit scheduler: refills the token bucket for the time elapsed, sends as many queued reports
+   as there are tokens, and sets the tx clock for when the next token is due. A report the backend
+   does not take stays at the front of its lane and is retried. */
+static void rawhid_hub_tx(t_rawhid_hub *h)
+{
+	t_rawhid_txq *q = NULL;
+	int i, r;
+
+	if (h->h_txrate > 0) {
+		h->h_tokens += clock_gettimesince(h->h_txlast) * h->h_txrate / 1000.;
+		if (h->h_tokens > h->h_txburst)
+			h->h_tokens = h->h_txburst;
+	}
+	h->h_txlast = clock_getlogicaltime();
+	while (h->h_online && (q = rawhid_hub_txlane(h))) {
+		if (h->h_txrate > 0 && h->h_tokens < 1)
+			break;
+		r = h->h_backend->send(h->h_num, rawhid_txq_front(q), RAWHID_BLOCK_SIZE, 0);
+		RAWHID_TRACE5(tx_send, RAWHID_TRACE_DEV(h), rawhid_txq_front(q)[0], RAWHID_BLOCK_SIZE,
+			      r, (long)(clock_gettimesince(q->q_stamps[q->q_head]) * 1000.));
+		if (r < 0) {
+			RAWHID_LOG(NULL, RAWHID_LOG_ERROR, "Write error, dropping %d queued reports",
+				   h->h_txq[RAWHID_LANE_RT].q_count +
+					   h->h_txq[RAWHID_LANE_BULK].q_count);
+			for (i = 0; i < RAWHID_LANES; i++) {
+				h->h_txq[i].q_dropped += h->h_txq[i].q_count;
+				h->h_txq[i].q_count = 0;
+			}
+			return;
+		} else if (r != RAWHID_BLOCK_SIZE) {
+			clock_delay(h->h_txclock, RAWHID_TX_RETRY);
+			return;
+		}
+		rawhid_txq_pop(q);
+		h->h_tokens -= 1;
+	}
+	if (h->h_online && q)
+		clock_delay(h->h_txclock, (1 - h->h_tokens) * 1000. / h->h_txrate);
+}
+
+/* Matches a report against the requests in flight by the sequence ID at byte h_seqpos, and
+   outputs "<seq> <rtt ms> <bytes...>" on the requester's response outlet. Returns 0 for reports
+   that answer no pending request, which then go to the data outlets as usual. */
+static int rawhid_hub_reply(t_rawhid_hub *h, unsigned char *buf, int len)
+{
+	t_atom at[RAWHID_BLOCK_SIZE + 2];
+	t_rawhid_req *r;
+	t_rawhid *owner;
+	int seq;
+
+	if (len <= h->h_seqpos || !(seq = buf[h->h_seqpos]) || !(owner = h->h_req[seq].r_owner))
+		return 0;
+	r = &h->h_req[seq];
+	SETFLOAT(at, seq);
+	SETFLOAT(at + 1, (sys_getrealtime() - r->r_sent) * 1000.);
+	rawhid_bytes_to_atoms(buf, at + 2, len);
+	r->r_owner = NULL;
+	h->h_nreq--;
+	rawhid_hub_reqschedule(h);
+	outlet_list(owner->x_resp_outlet, &s_list, len + 2, at);
+	return 1;
+}
+
+/* Sets the request clock for the earliest pending timeout. */
+static void rawhid_hub_reqschedule(t_rawhid_hub *h)
+{
+	double left, next = -1;
+	int i;
+
+	for (i = 1; h->h_nreq && i <= RAWHID_SEQ_MAX; i++) {
+		if (!h->h_req[i].r_owner)
+			continue;
+		left = h->h_req[i].r_timeout - clock_gettimesince(h->h_req[i].r_queued);
+		if (next < 0 || left < next)
+			next = left;
+	}
+	if (next < 0)
+		clock_unset(h->h_reqclock);
+	else
+		clock_delay(h->h_reqclock, next > 0 ? next : 0);
+}
+
+/* Request clock: outputs "timeout <seq>" for every request whose reply is overdue. */
+static void rawhid_hub_reqtimeout(t_rawhid_hub *h)
+{
+	t_rawhid_req *r;
+	t_rawhid *owner;
+	t_atom at;
+	int i;
+
+	h->h_dispatching = 1;
+	for (i = 1; !h->h_dead && h->h_nreq && i <= RAWHID_SEQ_MAX; i++) {
+		r = &h->h_req[i];
+		if (!(owner = r->r_owner) || clock_gettimesince(r->r_queued) < r->r_timeout)
+			continue;
+		r->r_owner = NULL;
+		h->h_nreq--;
+		SETFLOAT(&at, i);
+		outlet_anything(owner->x_resp_outlet, gensym("timeout"), 1, &at);
+	}
+	h->h_dispatching = 0;
+	if (h->h_dead) {
+		clock_free(h->h_clock);
+		freebytes(h, sizeof(*h));
+		return;
+	}
+	rawhid_hub_reqschedule(h);
+}
+
+static void rawhid_hub_unsubscribe(t_rawhid *x)
+{
+	t_rawhid_hub *h = x->x_hub;
+	t_rawhid **sp;
+	int i;
+
+	if (!h)
+		return;
+	for (i = 1; h->h_nreq && i <= RAWHID_SEQ_MAX; i++) {
+		if (h->h_req[i].r_owner == x) {
+			h->h_req[i].r_owner = NULL;
+			h->h_nreq--;
+		}
+	}
+	for (sp = &h->h_subs; *sp; sp = &(*sp)->x_next_sub) {
+		if (*sp == x) {
+			*sp = x->x_next_sub;
+			break;
+		}
+	}
+	x->x_hub = NULL;
+	x->x_next_sub = NULL;
+	x->x_isOpen = 0;
+	if (--h->h_refcount > 0) {
+		rawhid_hub_update(h);
+		return;
+	}
+	rawhid_hub_close(h);
+}
+
+static void *rawhid_cache_scan(void *arg)
+{
+	static rawhid_devinfo_t devs[RAWHID_MAX_DEVICES];
+	struct timespec until;
+	int n;
+
+	pthread_mutex_lock(&rawhid_cache_lock);
+	while (!rawhid_cache_stop) {
+		pthread_mutex_unlock(&rawhid_cache_lock);
+		n = rawhid_enumerate(devs, RAWHID_MAX_DEVICES, -1, -1, RAWHID_USAGE_PAGE,
+				     RAWHID_USAGE);
+		pthread_mutex_lock(&rawhid_cache_lock);
+		memcpy(rawhid_cache_devs, devs, n * sizeof(*devs));
+		rawhid_cache_count = n;
+		rawhid_cache_valid = 1;
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_sec += RAWHID_ENUM_INTERVAL / 1000;
+		until.tv_nsec += (RAWHID_ENUM_INTERVAL % 1000) * 1000000L;
+		if (until.tv_nsec >= 1000000000L) {
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000L;
+		}
+		if (!rawhid_cache_stop)
+			pthread_cond_timedwait(&rawhid_cache_wake, &rawhid_cache_lock, &until);
+	}
+	pthread_mutex_unlock(&rawhid_cache_lock);
+	return NULL;
+}
+
+static void rawhid_cache_acquire(void)
+{
+	if (rawhid_cache_users++)
+		return;
+	rawhid_cache_stop = 0;
+	if (pthread_create(&rawhid_cache_thread, NULL, rawhid_cache_scan, NULL) != 0) {
+		pd_error(NULL, "[rawhid] unable to start device enumeration thread");
+		rawhid_cache_users = 0;
+	}
+}
+
+static void rawhid_cache_release(void)
+{
+	if (!rawhid_cache_users || --rawhid_cache_users)
+		return;
+	pthread_mutex_lock(&rawhid_cache_lock);
+	rawhid_cache_stop = 1;
+	pthread_cond_signal(&rawhid_cache_wake);
+	pthread_mutex_unlock(&rawhid_cache_lock);
+	pthread_join(rawhid_cache_thread, NULL);
+	rawhid_cache_valid = 0;
+}
+
+/* Returns 1 and fills info if a cached device matches, 0 if none does, -1 if the first scan has
+   not completed yet. An empty serial matches any device. */
+static int rawhid_cache_lookup(int vid, int pid, const char *serial, rawhid_devinfo_t *info)
+{
+	int i, found = 0;
+
+	pthread_mutex_lock(&rawhid_cache_lock);
+	if (!rawhid_cache_valid)
+		found = -1;
+	for (i = 0; !found && i < rawhid_cache_count; i++) {
+		rawhid_devinfo_t *d = rawhid_cache_devs + i;
+		if (d->vid == vid && d->pid == pid && (!*serial || !strcmp(d->serial, serial))) {
+			*info = *d;
+			found = 1;
+		}
+	}
+	pthread_mutex_unlock(&rawhid_cache_lock);
+	return found;
+}
+
+/* devices : outputs "device <index> <vid> <pid> <serial> <usage page> <usage> <path> <in size>
+   <out size>" for every cached device, followed by "devices <count>". */
+static void rawhid_cache_list(t_rawhid *x)
+{
+	rawhid_devinfo_t devs[RAWHID_MAX_DEVICES];
+	t_atom at[9];
+	int i, n;
+
+	pthread_mutex_lock(&rawhid_cache_lock);
+	n = rawhid_cache_count;
+	memcpy(devs, rawhid_cache_devs, n * sizeof(*devs));
+	pthread_mutex_unlock(&rawhid_cache_lock);
+	for (i = 0; i < n; i++) {
+		SETFLOAT(at, i);
+		SETFLOAT(at + 1, devs[i].vid);
+		SETFLOAT(at + 2, devs[i].pid);
+		SETSYMBOL(at + 3, gensym(*devs[i].serial ? devs[i].serial : "-"));
+		SETFLOAT(at + 4, devs[i].usage_page);
+		SETFLOAT(at + 5, devs[i].usage);
+		SETSYMBOL(at + 6, gensym(devs[i].path));
+		SETFLOAT(at + 7, devs[i].input_size);
+		SETFLOAT(at + 8, devs[i].output_size);
+		outlet_anything(x->x_info_outlet, gensym("device"), 9, at);
+	}
+	SETFLOAT(at, n);
+	outlet_anything(x->x_info_outlet, gensym("devices"), 1, at);
+}
+
+/* Sends a received report out of the outlet subscribed to its first byte (report ID). Without
+ * creation arguments every report goes to the single data outlet. Reports rejected by the
+ * instance's filter are dropped before any outlet call. */
+static void rawhid_output_report(t_rawhid *x, unsigned char *buf, int len)
+{
+	t_outlet *out = x->x_data_outlet;
+	int j;
+
+	if (x->x_naccept && !x->x_accept[buf[0]])
+		return;
+	if (x->x_nroutes) {
+		out = x->x_route[buf[0]];
+		if (!out) {
+			DEBUG_POST(("[rawhid] dropping report with unsubscribed id %d", buf[0]));
+			return;
+		}
+	}
+	if (x->x_decoders[buf[0]]) {
+		if (len >= x->x_decoders[buf[0]]->d_layout.t_len)
+			rawhid_decode_report(x, x->x_decoders[buf[0]], out, buf);
+		return;
+	}
+	if (x->x_listmode) {
+		if (len > x->x_outsize) {
+			x->x_outatoms = (t_atom *)resizebytes(x->x_outatoms, x->x_outsize * sizeof(t_atom),
+							      len * sizeof(t_atom));
+			x->x_outsize = len;
+		}
+		rawhid_bytes_to_atoms(buf, x->x_outatoms, len);
+		outlet_list(out, &s_list, len, x->x_outatoms);
+		return;
+	}
+	for (j = 0; j < len; j++) {
+		outlet_float(out, (t_float)buf[j]);
+	}
+}
+
+static int write_serial(t_rawhid *x, unsigned char serial_byte)
+{
+	if (!x->x_isOpen) {
+		RAWHID_LOG(x, RAWHID_LOG_WARN, "No device open");
+		return 0;
+	} else if (x->x_outbuf_wr_index < x->x_outbuf_len) {
+		DEBUG_POST(("[rawhid] Adding float to buffer"));
+		x->x_outbuf[x->x_outbuf_wr_index++] = serial_byte;
+		return 1;
+	}
+	/* handle overrun error */
+	RAWHID_LOG(x, RAWHID_LOG_ERROR, "buffer is full, byte dropped (TX overrun)");
+	return 0;
+}
+
+/* Queues a copy of frame on a lane of the hub and starts sending if the hub was idle. Returns 0
+   if the lane is full. */
+static int rawhid_hub_queue(t_rawhid_hub *h, unsigned char *frame, int lane)
+{
+	if (!rawhid_txq_push(&h->h_txq[lane], frame))
+		return 0;
+	RAWHID_TRACE4(tx_enqueue, RAWHID_TRACE_DEV(h), frame[0], RAWHID_BLOCK_SIZE, lane);
+	if (h->h_txq[RAWHID_LANE_RT].q_count + h->h_txq[RAWHID_LANE_BULK].q_count == 1)
+		rawhid_hub_tx(h);
+	return 1;
+}
+
+static int write_frame(t_rawhid *x, unsigned char *frame, int lane)
+{
+	if (!rawhid_hub_queue(x->x_hub, frame, lane)) {
+		RAWHID_LOG(x, RAWHID_LOG_ERROR, "Transmit queue is full, dropping reports");
+		return -1;
+	}
+	return RAWHID_BLOCK_SIZE;
+}
+
+static t_rawhid_hub *rawhid_hub_find(const rawhid_backend_t *b, int vid, int pid)
+{
+	t_rawhid_hub *h;
+
+	for (h = rawhid_hubs; h; h = h->h_next) {
+		if (h->h_backend == b && h->h_vid == vid && h->h_pid == pid)
+			return h;
+	}
+	return NULL;
+}
+
+/* The port's "queue" method, which [rawhid_out~] calls from its clock, see rawhid_port.h. A
+   NULL backend means the platform's own, which 'open' uses unless told otherwise. */
+static int rawhid_port_queue(t_pd *port, t_symbol *backend, int vid, int pid,
+			     unsigned char *frame)
+{
+	const rawhid_backend_t *b = rawhid_backends[0];
+	t_rawhid_hub *h;
+
+	if (backend && !(b = rawhid_backend_find(backend->s_name)))
+		return 0;
+	h = rawhid_hub_find(b, vid, pid);
+
+	return h && h->h_online && rawhid_hub_queue(h, frame, RAWHID_LANE_RT);
+}
+
+static void rawhid_float(t_rawhid *x, t_float f)
+{
+	unsigned char serial_byte = ((int)f) & 0xFF; /* brutal conv */
+
+	write_serial(x, serial_byte); /* which logs why a byte was not taken */
+}
+
+/* Converts n values, from atoms or else from array words, straight into RAWHID_BLOCK_SIZE
+   frames and queues each one as soon as it is full, so messages of any length go out without an
+   intermediate buffer. Unframed, the last frame is zero padded, and n == 0 sends nothing, as a
+   bang or an empty list always has. Framed, every frame repeats the message's first h_frameoff
+   bytes, and its header says how many of the bytes after it are the message's, so the last
+   frame's padding is not taken for data. */
+static void rawhid_write_values(t_rawhid *x, const t_atom *av, const t_word *wv, int n, int lane)
+{
+	unsigned char frame[RAWHID_BLOCK_SIZE];
+	int off = x->x_hub->h_frameoff, head = 0, at = 0, k;
+
+	if (!n)
+		return;
+	if (off >= 0) {
+		at = (n < off) ? n : off;
+		if (av)
+			rawhid_atoms_to_bytes(av, frame, at);
+		else
+			rawhid_words_to_bytes(wv, frame, at);
+		memset(frame + at, 0, off - at);
+		head = off + 1;
+	}
+	do {
+		k = (n - at < RAWHID_BLOCK_SIZE - head) ? n - at : RAWHID_BLOCK_SIZE - head;
+		if (av)
+			rawhid_atoms_to_bytes(av + at, frame + head, k);
+		else
+			rawhid_words_to_bytes(wv + at, frame + head, k);
+		memset(frame + head + k, 0, RAWHID_BLOCK_SIZE - head - k);
+		if (off >= 0)
+			frame[off] = (at > off ? RAWHID_FRAME_CONT : 0) |
+				     (at + k < n ? RAWHID_FRAME_MORE : 0) | k;
+		if (write_frame(x, frame, lane) < 0)
+			return;
+		at += k;
+	} while (at < n);
+}
+
+static void rawhid_write_atoms(t_rawhid *x, int argc, t_atom *argv, int lane)
+{
+	if (!x->x_isOpen) {
+		RAWHID_LOG(x, RAWHID_LOG_WARN, "Serial port is not open");
+		return;
+	}
+	rawhid_write_values(x, argv, NULL, argc, lane);
+}
+
+/* A list goes out on the rt lane, ahead of any queued bulk reports. */
+static void rawhid_list(t_rawhid *x, t_symbol *s, int argc, t_atom *argv)
+{
+	rawhid_write_atoms(x, argc, argv, RAWHID_LANE_RT);
+}
+
+/* bulk <bytes...> : like a list, but only sent in slots the rt lane leaves free */
+static void rawhid_bulk(t_rawhid *x, t_symbol *s, int argc, t_atom *argv)
+{
+	rawhid_write_atoms(x, argc, argv, RAWHID_LANE_BULK);
+}
+
+/* sendtable <array> [<offset> [<len>]] : sends array elements as reports, converting the array
+   memory straight into frames instead of going through a list. len <= 0 means up to the end. */
+static void rawhid_sendtable(t_rawhid *x, t_symbol *name, t_float offset, t_float len)
+{
+	t_garray *a;
+	t_word *vec;
+	int size, on, n;
+
+	if (!x->x_isOpen) {
+		RAWHID_LOG(x, RAWHID_LOG_WARN, "Serial port is not open");
+		return;
+	}
+	if (!(a = (t_garray *)pd_findbyclass(name, garray_class))) {
+		pd_error(x, "[rawhid] sendtable: %s: no such array", name->s_name);
+		return;
+	}
+	if (!garray_getfloatwords(a, &size, &vec)) {
+		pd_error(x, "[rawhid] sendtable: %s: bad template", name->s_name);
+		return;
+	}
+	on = (offset < 0) ? 0 : (int)offset;
+	if (on > size)
+		on = size;
+	n = (len <= 0) ? size - on : (int)len;
+	if (n > size - on)
+		n = size - on;
+	if (n > 0)
+		rawhid_write_values(x, NULL, vec + on, n, RAWHID_LANE_BULK);
+}
+
+/* open <vid> <pid> [<serial>] : the serial picks one of several identical devices */
+static void rawhid_open_device(t_rawhid *x, t_symbol *s, int argc, t_atom *argv)
+{
+	t_symbol *brandId = atom_getsymbolarg(0, argc, argv);
+	t_symbol *productId = atom_getsymbolarg(1, argc, argv);
+	int bId = (int)strtol(brandId->s_name, NULL, 16);
+	int pId = (int)strtol(productId->s_name, NULL, 16);
+	char serial[64] = "";
+
+	if (argc > 2)
+		atom_string(argv + 2, serial, sizeof(serial));
+	if ((bId > 0) && (brandId->s_name[0] == '0') && (brandId->s_name[1] == 'x') && (pId > 0) &&
+	    (productId->s_name[0] == '0') && (productId->s_name[1] == 'x')) {
+		if (x->x_hub)
+			rawhid_hub_unsubscribe(x);
+		x->x_brandId = bId;
+		x->x_productId = pId;
+		if (!rawhid_hub_subscribe(x, bId, pId, serial)) {
+			post("[rawhid] Impossible to open device %s %s", brandId->s_name,
+			     productId->s_name);
+			return;
+		}
+		if (!x->x_hub)
+			return; /* closed again by a reaction to "connect" */
+		post("[rawhid] Device %s %s open (%d subscribers)", brandId->s_name,
+		     productId->s_name, x->x_hub->h_refcount);
+		rawhid_shadow_resend(x);
+	} else {
+		post("[rawhid] Invalid input for open operation. (e.g. open 0x002a 0x160c)",
+		     brandId->s_name, productId->s_name);
+	}
+}
+
+/* A hub that went offline and waits to reconnect still holds its subscribers, so closing depends
+   on x_hub rather than x_isOpen. */
+static void rawhid_close_device(t_rawhid *x)
+{
+	int i;
+
+	if (x->x_hub) {
+		rawhid_hub_unsubscribe(x);
+		post("[rawhid] Device 0x%04x 0x%04x closed", x->x_brandId, x->x_productId);
+	} else {
+		post("[rawhid] There are no open devices to close.");
+	}
+	x->x_isOpen = 0;
+	x->x_outbuf_wr_index = 0;
+	for (i = 0; i < RAWHID_MAX_IDS; i++) {
+		if (x->x_decoders[i])
+			x->x_decoders[i]->d_count = x->x_decoders[i]->d_primed = 0;
+	}
+}
+
+static void rawhid_poll(t_rawhid *x, t_float poll)
+{
+	post("[rawhid] Polling set to %.01fms", poll);
+	x->x_deltime = poll;
+	if (x->x_hub)
+		rawhid_hub_update(x->x_hub);
+}
+
+static void rawhid_packets(t_rawhid *x, t_float packets)
+{
+	x->x_packets_to_recv = (size_t)packets;
+	post("[rawhid] Packets to receive per poll set to %d", x->x_packets_to_recv);
+	if (x->x_hub)
+		rawhid_hub_update(x->x_hub);
+}
+
+/* reconnect 1 : when the device goes offline, wait for it in the background and reopen it */
+static void rawhid_reconnect(t_rawhid *x, t_float on)
+{
+	x->x_reconnect = (on != 0);
+	post("[rawhid] Automatic reconnect %s", x->x_reconnect ? "on" : "off");
+}
+
+/* txrate <reports per second> [<burst>] : paces outbound reports, e.g. 1000 for a 1 ms interval
+   endpoint. 0 sends as fast as the backend accepts. Reports above the rate are queued. */
+static void rawhid_txrate(t_rawhid *x, t_float rate, t_float burst)
+{
+	x->x_txrate = (rate > 0) ? rate : 0;
+	x->x_txburst = (burst >= 1) ? burst : 1;
+	post("[rawhid] Transmit rate set to %g reports/s, burst %g", x->x_txrate, x->x_txburst);
+	if (x->x_hub) {
+		x->x_hub->h_txrate = x->x_txrate;
+		x->x_hub->h_txburst = x->x_txburst;
+		rawhid_hub_tx(x->x_hub);
+	}
+}
+
+/* Outputs "txstat <lane> <queued> <sent> <dropped> <mean latency ms> <max latency ms>" for the
+   rt and the bulk lane. */
+static void rawhid_txstat(t_rawhid *x)
+{
+	static const char *lanes[RAWHID_LANES] = { "rt", "bulk" };
+	t_rawhid_txq *q;
+	t_atom at[6];
+	int i;
+
+	if (!x->x_hub) {
+		post("[rawhid] No device open");
+		return;
+	}
+	for (i = 0; i < RAWHID_LANES; i++) {
+		q = &x->x_hub->h_txq[i];
+		SETSYMBOL(at, gensym(lanes[i]));
+		SETFLOAT(at + 1, q->q_count);
+		SETFLOAT(at + 2, q->q_sent);
+		SETFLOAT(at + 3, q->q_dropped);
+		SETFLOAT(at + 4, q->q_sent ? q->q_latency_sum / q->q_sent : 0);
+		SETFLOAT(at + 5, q->q_latency_max);
+		outlet_anything(x->x_info_outlet, gensym("txstat"), 6, at);
+	}
+}
+
+/* rxqueue <size> [oldest|newest|latest] : bounds the inbound queue of the device. When it is full
+   the oldest or the arriving report is dropped; 'latest' keeps only the newest report per ID. */
+static void rawhid_rxqueue(t_rawhid *x, t_symbol *s, int argc, t_atom *argv)
+{
+	static const char *policies[] = { "oldest", "newest", "latest" };
+	int size = (int)atom_getfloatarg(0, argc, argv);
+	t_symbol *policy = atom_getsymbolarg(1, argc, argv);
+	int i;
+
+	if (size < 1 || size > RAWHID_RXQ_MAX) {
+		pd_error(x, "[rawhid] rxqueue: size %d out of range 1..%d", size, RAWHID_RXQ_MAX);
+		return;
+	}
+	if (argc > 1) {
+		for (i = 0; i < 3 && strcmp(policy->s_name, policies[i]); i++)
+			;
+		if (i == 3) {
+			pd_error(x, "[rawhid] rxqueue: unknown policy '%s', expected oldest, newest or latest",
+				 policy->s_name);
+			return;
+		}
+		x->x_rxpolicy = i;
+	}
+	x->x_rxsize = size;
+	post("[rawhid] Inbound queue set to %d reports, overflow policy %s", x->x_rxsize,
+	     policies[x->x_rxpolicy]);
+	if (x->x_hub)
+		rawhid_rxq_init(&x->x_hub->h_rxq, x->x_rxsize, x->x_rxpolicy);
+}
+
+/* Outputs "rxstat <queued> <received> <dropped> <replaced>". */
+static void rawhid_rxstat(t_rawhid *x)
+{
+	t_rawhid_rxq *q;
+	t_atom at[4];
+
+	if (!x->x_hub) {
+		post("[rawhid] No device open");
+		return;
+	}
+	q = &x->x_hub->h_rxq;
+	SETFLOAT(at, q->q_count);
+	SETFLOAT(at + 1, q->q_received);
+	SETFLOAT(at + 2, q->q_dropped);
+	SETFLOAT(at + 3, q->q_replaced);
+	outlet_anything(x->x_info_outlet, gensym("rxstat"), 4, at);
+}
+
+#if RAWHID_EPOLL
+/* rtprio <n> [fifo|rr] : realtime priority for the I/O thread that reads every device, 0 for
+   normal scheduling. Without the privilege the thread keeps its normal priority. */
+static void rawhid_rtprio(t_rawhid *x, t_symbol *s, int argc, t_atom *argv)
+{
+	int rr = (atom_getsymbolarg(1, argc, argv) == gensym("rr"));
+	int policy = rr ? SCHED_RR : SCHED_FIFO;
+	int prio = (int)atom_getfloatarg(0, argc, argv);
+
+	if (prio < 0)
+		prio = 0;
+	if (prio > sched_get_priority_max(policy))
+		prio = sched_get_priority_max(policy);
+	rawhid_io_prio = prio;
+	rawhid_io_policy = policy;
+	if (prio)
+		post("[rawhid] I/O thread priority set to %d (%s)", prio,
+		     rr ? "SCHED_RR" : "SCHED_FIFO");
+	else
+		post("[rawhid] I/O thread priority set to normal");
+	if (rawhid_io_count)
+		rawhid_io_sched();
+}
+
+/* affinity <cpu-list> : pins the I/O thread, e.g. 'affinity 2 3' or 'affinity 0-3,6'. No
+   arguments lets it run on any CPU. */
+static void rawhid_affinity(t_rawhid *x, t_symbol *s, int argc, t_atom *argv)
+{
+	cpu_set_t cpus;
+	int i;
+
+	CPU_ZERO(&cpus);
+	for (i = 0; i < argc; i++) {
+		char buf[MAXPDSTRING], *p = buf, *end;
+		long lo, hi;
+		atom_string(argv + i, buf, sizeof(buf));
+		while (*p) {
+			lo = hi = strtol(p, &end, 10);
+			if (end != p && *end == '-')
+				hi = strtol(end + 1, &end, 10);
+			if (end == p || lo < 0 || hi < lo || hi >= CPU_SETSIZE) {
+				pd_error(x, "[rawhid] affinity: invalid cpu list %s", buf);
+				return;
+			}
+			for (; lo <= hi; lo++)
+				CPU_SET(lo, &cpus);
+			p = (*end == ',') ? end + 1 : end;
+			if (*p && *end != ',') {
+				pd_error(x, "[rawhid] affinity: invalid cpu list %s", buf);
+				return;
+			}
+		}
+	}
+	rawhid_io_cpus = cpus;
+	rawhid_io_pinned = (CPU_COUNT(&cpus) > 0);
+	if (rawhid_io_pinned)
+		post("[rawhid] I/O thread pinned to %d CPUs", CPU_COUNT(&cpus));
+	else
+		post("[rawhid] I/O thread may run on any CPU");
+	if (rawhid_io_count)
+		rawhid_io_sched();
+}
+
+/* iolatency <ms> : wakes the I/O thread every <ms> to measure how late it gets to run, 0 stops.
+   Without an argument outputs "iolatency <probes> <max us> <count>...", where the count k is
+   of wakeups 2^k to 2^(k+1) microseconds late (the first also those below 1, the last all
+   above). */
+static void rawhid_iolatency(t_rawhid *x, t_symbol *s, int argc, t_atom *argv)
+{
+	t_atom at[RAWHID_LAT_BUCKETS + 2];
+	int i, ms;
+
+	if (!argc) {
+		pthread_mutex_lock(&rawhid_io_lock);
+		SETFLOAT(at, rawhid_io_probes);
+		SETFLOAT(at + 1, rawhid_io_latmax);
+		for (i = 0; i < RAWHID_LAT_BUCKETS; i++)
+			SETFLOAT(at + 2 + i, rawhid_io_hist[i]);
+		pthread_mutex_unlock(&rawhid_io_lock);
+		outlet_anything(x->x_info_outlet, gensym("iolatency"), RAWHID_LAT_BUCKETS + 2, at);
+		return;
+	}
+	ms = (int)atom_getfloat(argv);
+	rawhid_io_probe_ms = (ms < 0) ? 0 : (ms > 1000) ? 1000 : ms;
+	pthread_mutex_lock(&rawhid_io_lock);
+	memset(rawhid_io_hist, 0, sizeof(rawhid_io_hist));
+	rawhid_io_probes = 0;
+	rawhid_io_latmax = 0;
+	pthread_mutex_unlock(&rawhid_io_lock);
+	if (rawhid_io_count)
+		rawhid_io_probe_arm();
+	if (rawhid_io_probe_ms)
+		post("[rawhid] Probing I/O thread wakeup latency every %d ms", rawhid_io_probe_ms);
+	else
+		post("[rawhid] I/O thread latency probe off");
+}
+#else
+static void rawhid_rtprio(t_rawhid *x, t_symbol *s, int argc, t_atom *argv)
+{
+	post("[rawhid] rtprio: there is no I/O thread on this platform");
+}
+
+static void rawhid_affinity(t_rawhid *x, t_symbol *s, int argc, t_atom *argv)
+{
+	post("[rawhid] affinity: there is no I/O thread on this platform");
+}
+
+static void rawhid_iolatency(t_rawhid *x, t_symbol *s, int argc, t_atom *argv)
+{
+	post("[rawhid] iolatency: there is no I/O thread on this platform");
+}
+#endif
+
+/* request <bytes...> : sends one report on the rt lane with a free sequence ID written at byte
+   'seqpos'. Outputs "sent <seq>" on the response outlet, later followed by either the reply as
+   "<seq> <rtt ms> <bytes...>" or "timeout <seq>". Many requests can be in flight at once. */
+static void rawhid_request(t_rawhid *x, t_symbol *s, int argc, t_atom *argv)
+{
+	unsigned char frame[RAWHID_BLOCK_SIZE];
+	t_rawhid_hub *h = x->x_hub;
+	t_rawhid_req *r;
+	t_atom at;
+	int seq;
+
+	if (!x->x_isOpen) {
+		RAWHID_LOG(x, RAWHID_LOG_WARN, "Serial port is not open");
+		return;
+	}
+	if (argc > RAWHID_BLOCK_SIZE) {
+		pd_error(x, "[rawhid] request: more than %d bytes", RAWHID_BLOCK_SIZE);
+		return;
+	}
+	if (h->h_nreq >= RAWHID_SEQ_MAX) {
+		pd_error(x, "[rawhid] request: %d requests already in flight", RAWHID_SEQ_MAX);
+		return;
+	}
+	seq = h->h_seq;
+	do {
+		seq = seq % RAWHID_SEQ_MAX + 1;
+	} while (h->h_req[seq].r_owner);
+	rawhid_atoms_to_bytes(argv, frame, argc);
+	memset(frame + argc, 0, RAWHID_BLOCK_SIZE - argc);
+	frame[h->h_seqpos] = seq;
+	r = &h->h_req[seq];
+	r->r_owner = x;
+	r->r_sent = sys_getrealtime();
+	r->r_queued = clock_getlogicaltime();
+	r->r_timeout = x->x_reqtimeout;
+	h->h_seq = seq;
+	h->h_nreq++;
+	if (write_frame(x, frame, RAWHID_LANE_RT) < 0) {
+		r->r_owner = NULL;
+		h->h_nreq--;
+		return;
+	}
+	rawhid_hub_reqschedule(h);
+	SETFLOAT(&at, seq);
+	outlet_anything(x->x_resp_outlet, gensym("sent"), 1, &at);
+}
+
+/* seqpos <n> : byte offset of the sequence ID in requests and replies, 1 by default so the
+   report ID in byte 0 is left alone. Shared by all objects on the same device. */
+static void rawhid_seqpos(t_rawhid *x, t_float pos)
+{
+	if (pos < 0 || pos >= RAWHID_BLOCK_SIZE) {
+		pd_error(x, "[rawhid] seqpos: %g out of range 0..%d", pos, RAWHID_BLOCK_SIZE - 1);
+		return;
+	}
+	x->x_seqpos = (int)pos;
+	if (x->x_hub)
+		x->x_hub->h_seqpos = x->x_seqpos;
+}
+
+/* seqcheck <offset> [<size>] [be] : treats <size> bytes (1..4, little endian unless be) at
+   <offset> of every report as the device's sequence counter, see 'seqstat'. No arguments turns
+   it off. Shared by all objects on the same device. */
+static void rawhid_seqcheck(t_rawhid *x, t_symbol *s, int argc, t_atom *argv)
+{
+	t_rawhid_hub *h = x->x_hub;
+	int off = -1, size = 1, big = 0;
+
+	if (argc) {
+		off = (int)atom_getfloatarg(0, argc, argv);
+		if (argc > 1 && argv[1].a_type == A_FLOAT)
+			size = (int)atom_getfloatarg(1, argc, argv);
+		big = (atom_getsymbolarg(argc - 1, argc, argv) == gensym("be"));
+		if (off < 0 || size < 1 || size > 4 || off + size > RAWHID_BLOCK_SIZE) {
+			pd_error(x, "[rawhid] seqcheck: expected <offset> <size 1..4> within %d bytes",
+				 RAWHID_BLOCK_SIZE);
+			return;
+		}
+	}
+	x->x_seqoff = off;
+	x->x_seqsize = size;
+	x->x_seqbig = big;
+	if (h) {
+		rawhid_io_hold(h);
+		h->h_seqoff = off;
+		h->h_seqsize = size;
+		h->h_seqbig = big;
+		memset(&h->h_seqrx, 0, sizeof(h->h_seqrx));
+		memset(&h->h_seqout, 0, sizeof(h->h_seqout));
+		rawhid_io_release(h);
+	}
+	if (off < 0)
+		post("[rawhid] Sequence check off");
+	else
+		post("[rawhid] Sequence counter at byte %d, %d bytes %s endian", off, size,
+		     big ? "big" : "little");
+}
+
+/* Outputs "seqstat <received> <device lost> <queue lost> <duplicates> <reordered> <loss %>".
+   Device loss are counter values that never reached the backend; queue loss are reports the
+   backend delivered but the inbound queue or I/O ring dropped before dispatch. */
+static void rawhid_seqstat(t_rawhid *x)
+{
+	t_rawhid_hub *h = x->x_hub;
+	t_rawhid_seqtrack rx, out;
+	double expected;
+	t_atom at[6];
+
+	if (!h) {
+		post("[rawhid] No device open");
+		return;
+	}
+	rawhid_io_hold(h);
+	rx = h->h_seqrx;
+	rawhid_io_release(h);
+	out = h->h_seqout;
+	expected = (double)out.c_received - out.c_dup + out.c_lost;
+	SETFLOAT(at, out.c_received);
+	SETFLOAT(at + 1, rx.c_lost);
+	SETFLOAT(at + 2, out.c_lost > rx.c_lost ? out.c_lost - rx.c_lost : 0);
+	SETFLOAT(at + 3, rx.c_dup);
+	SETFLOAT(at + 4, rx.c_reorder);
+	SETFLOAT(at + 5, expected > 0 ? 100. * out.c_lost / expected : 0);
+	outlet_anything(x->x_info_outlet, gensym("seqstat"), 6, at);
+}
+
+static const struct {
+	const char *	name;
+	int 		width;
+	uint32_t 	poly;
+	uint32_t 	init;
+	uint32_t 	xorout;
+	int 		refl;
+} rawhid_crc_presets[] = {
+	{"crc8", 8, 0x07, 0, 0, 0},
+	{"maxim", 8, 0x31, 0, 0, 1},
+	{"crc16", 16, 0x8005, 0, 0, 1}, /* CRC-16/ARC */
+	{"modbus", 16, 0x8005, 0xFFFF, 0, 1},
+	{"ccitt", 16, 0x1021, 0xFFFF, 0, 0}, /* CRC-16/CCITT-FALSE */
+	{"xmodem", 16, 0x1021, 0, 0, 0},
+	{"crc32", 32, RAWHID_CRC32_POLY, 0xFFFFFFFF, 0xFFFFFFFF, 1},
+	{"crc32c", 32, RAWHID_CRC32C_POLY, 0xFFFFFFFF, 0xFFFFFFFF, 1},
+};
+
+/* A number given as a float, or as a symbol like 0xEDB88320 for values a float cannot hold. */
+static int rawhid_atom_u32(t_atom *a, uint32_t *v)
+{
+	char *end;
+
+	if (a->a_type == A_FLOAT) {
+		*v = (uint32_t)(long long)a->a_w.w_float;
+		return 1;
+	}
+	if (a->a_type != A_SYMBOL || !*a->a_w.w_symbol->s_name)
+		return 0;
+	*v = (uint32_t)strtoul(a->a_w.w_symbol->s_name, &end, 0);
+	return !*end;
+}
+
+/* Gives the hub the CRC check configured on x, resetting its counts. */
+static void rawhid_hub_setcrc(t_rawhid_hub *h, t_rawhid *x)
+{
+	if (!x->x_crcwidth) {
+		if (h->h_crc)
+			freebytes(h->h_crc, sizeof(*h->h_crc));
+		h->h_crc = NULL;
+		return;
+	}
+	if (!h->h_crc)
+		h->h_crc = (t_rawhid_crc *)getbytes(sizeof(*h->h_crc));
+	rawhid_crc_init(h->h_crc, x->x_crcwidth, x->x_crcpoly, x->x_crcinit, x->x_crcxorout,
+			x->x_crcrefl);
+	h->h_crcoff = x->x_crcoff;
+	h->h_crcbig = x->x_crcbig;
+	h->h_crcflag = x->x_crcflag;
+	h->h_crcchecked = h->h_crcfailed = 0;
+}
+
+/* crc <preset> <offset> [be] [flag]
+   crc <width> <poly> <offset> [<init> [<xorout>]] [refl] [be] [flag]
+   Checks the CRC-8, -16 or -32 stored at byte <offset> (little endian unless be) over the bytes
+   before it. Bad reports are dropped, or with flag output after a crcfail. No arguments turns
+   the check off. Shared by all objects on the same device. */
+static void rawhid_crccheck(t_rawhid *x, t_symbol *s, int argc, t_atom *argv)
+{
+	uint32_t width = 0, poly = 0, init = 0, xorout = 0, off = 0, v;
+	int refl = 0, big = 0, flag = 0, custom = 1, nnum = 0, i = 0, j;
+	t_symbol *arg;
+
+	if (argc && argv[0].a_type == A_SYMBOL) {
+		for (j = 0; j < (int)(sizeof(rawhid_crc_presets) / sizeof(rawhid_crc_presets[0])); j++) {
+			if (strcmp(argv[0].a_w.w_symbol->s_name, rawhid_crc_presets[j].name))
+				continue;
+			width = rawhid_crc_presets[j].width;
+			poly = rawhid_crc_presets[j].poly;
+			init = rawhid_crc_presets[j].init;
+			xorout = rawhid_crc_presets[j].xorout;
+			refl = rawhid_crc_presets[j].refl;
+			custom = 0;
+			i = 1;
+			break;
+		}
+	}
+	if (argc && custom) {
+		if (argc < 3 || !rawhid_atom_u32(argv, &width) || !rawhid_atom_u32(argv + 1, &poly))
+			goto usage;
+		i = 2;
+	}
+	if (argc) {
+		if (i >= argc || !rawhid_atom_u32(argv + i, &off))
+			goto usage;
+		for (i++; i < argc; i++) {
+			arg = atom_getsymbolarg(i, argc, argv);
+			if (arg == gensym("refl") && custom)
+				refl = 1;
+			else if (arg == gensym("be"))
+				big = 1;
+			else if (arg == gensym("flag"))
+				flag = 1;
+			else if (custom && nnum < 2 && rawhid_atom_u32(argv + i, &v))
+				*(nnum++ ? &xorout : &init) = v;
+			else
+				goto usage;
+		}
+		if ((width != 8 && width != 16 && width != 32) ||
+		    off + width / 8 > RAWHID_BLOCK_SIZE) {
+			pd_error(x, "[rawhid] crc: width must be 8, 16 or 32 with the checksum "
+				    "within %d bytes", RAWHID_BLOCK_SIZE);
+			return;
+		}
+	}
+	x->x_crcwidth = width;
+	x->x_crcpoly = poly;
+	x->x_crcinit = init;
+	x->x_crcxorout = xorout;
+	x->x_crcrefl = refl;
+	x->x_crcoff = off;
+	x->x_crcbig = big;
+	x->x_crcflag = flag;
+	if (x->x_hub)
+		rawhid_hub_setcrc(x->x_hub, x);
+	if (!width)
+		post("[rawhid] CRC check off");
+	else
+		post("[rawhid] Checking CRC-%d 0x%0*x at byte %d, bad reports are %s", (int)width,
+		     (int)width / 4, poly, (int)off, flag ? "flagged" : "dropped");
+	return;
+usage:
+	pd_error(x, "[rawhid] crc: expected <preset> <offset> or <width> <poly> <offset> "
+		    "[<init> [<xorout>]] [refl], then [be] [flag]");
+}
+
+/* Outputs "crcstat <checked> <failed> <failure %> <kernel>". */
+static void rawhid_crcstat(t_rawhid *x)
+{
+	t_rawhid_hub *h = x->x_hub;
+	t_atom at[4];
+
+	if (!h || !h->h_crc) {
+		post("[rawhid] No CRC check on an open device");
+		return;
+	}
+	SETFLOAT(at, h->h_crcchecked);
+	SETFLOAT(at + 1, h->h_crcfailed);
+	SETFLOAT(at + 2, h->h_crcchecked ? 100. * h->h_crcfailed / h->h_crcchecked : 0);
+	SETSYMBOL(at + 3, gensym(h->h_crc->c_kernel));
+	outlet_anything(x->x_info_outlet, gensym("crcstat"), 4, at);
+}
+
+/* framing [<offset>] : reports carry a length and continuation header at byte <offset>, after
+   as many prefix bytes (a report ID say) repeated in every report. Lists and tables longer than
+   one report go out as several, and the reports of a message are output once as a whole, up to
+   RAWHID_MSG_MAX bytes. No arguments turns it off. Replies to requests are never framed. */
+static void rawhid_framing(t_rawhid *x, t_symbol *s, int argc, t_atom *argv)
+{
+	int off = argc ? (int)atom_getfloatarg(0, argc, argv) : -1;
+
+	if (argc && (argv[0].a_type != A_FLOAT || off < 0 || off > RAWHID_BLOCK_SIZE - 2)) {
+		pd_error(x, "[rawhid] framing: header offset must be 0..%d", RAWHID_BLOCK_SIZE - 2);
+		return;
+	}
+	x->x_frameoff = off;
+	if (x->x_hub) {
+		x->x_hub->h_frameoff = off;
+		x->x_hub->h_msgopen = 0;
+	}
+	if (off < 0)
+		post("[rawhid] Framing off");
+	else
+		post("[rawhid] Framing header at byte %d, %d message bytes per report", off,
+		     RAWHID_BLOCK_SIZE - 1 - off);
+}
+
+/* timeout <ms> : how long a request waits for its reply */
+static void rawhid_timeout(t_rawhid *x, t_float ms)
+{
+	x->x_reqtimeout = (ms > 0) ? ms : RAWHID_REQ_TIMEOUT;
+}
+
+/* Marks a shadowed report for the next flush, which runs once at the end of this logical time so
+   that all updates sent in the same tick go out together. */
+static void rawhid_shadow_touch(t_rawhid *x, int id)
+{
+	if (!x->x_shadow[id]->s_dirty) {
+		x->x_shadow[id]->s_dirty = 1;
+		x->x_dirty[x->x_ndirty++] = id;
+	}
+	clock_delay(x->x_shadowclock, 0);
+}
+
+/* shadow <id> <index> <value> [<index> <value> ...] : changes single bytes of the report with
+   that ID. Only reports that differ from what was last sent are transmitted. Without arguments
+   every shadowed report is sent again, e.g. after the device was replugged. */
+static void rawhid_shadow(t_rawhid *x, t_symbol *s, int argc, t_atom *argv)
+{
+	t_rawhid_shadow *sh;
+	int id, i;
+
+	if (!argc) {
+		rawhid_shadow_resend(x);
+		return;
+	}
+	id = (int)atom_getfloat(argv);
+	if (id < 0 || id >= RAWHID_MAX_IDS || !(argc & 1)) {
+		pd_error(x, "[rawhid] shadow: expected <id 0..255> followed by <index> <value> pairs");
+		return;
+	}
+	if (!(sh = x->x_shadow[id])) {
+		sh = x->x_shadow[id] = (t_rawhid_shadow *)getbytes(sizeof(*sh));
+		sh->s_state[0] = id;
+	}
+	for (i = 1; i < argc; i += 2) {
+		int index = (int)atom_getfloat(argv + i);
+		if (index < 1 || index >= RAWHID_BLOCK_SIZE) {
+			pd_error(x, "[rawhid] shadow: index %d out of range 1..%d", index,
+				 RAWHID_BLOCK_SIZE - 1);
+			continue;
+		}
+		sh->s_state[index] = (unsigned char)atom_getfloat(argv + i + 1);
+	}
+	rawhid_shadow_touch(x, id);
+}
+
+/* Forgets what the device has, so that the next flush sends every shadowed report in full. */
+static void rawhid_shadow_resend(t_rawhid *x)
+{
+	int id;
+
+	for (id = 0; id < RAWHID_MAX_IDS; id++) {
+		if (x->x_shadow[id]) {
+			x->x_shadow[id]->s_valid = 0;
+			rawhid_shadow_touch(x, id);
+		}
+	}
+}
+
+/* Marks the changes a queued delta report carries as sent. */
+static void rawhid_shadow_sent(t_rawhid *x, const unsigned char *frame)
+{
+	int k;
+
+	for (k = 0; k < frame[1]; k++)
+		x->x_shadow[frame[2 + 3 * k]]->s_sent[frame[3 + 3 * k]] = frame[4 + 3 * k];
+}
+
+/* Queues the dirty reports. Without a delta command each changed report goes out in full. With
+   one, changes to reports the device already has are packed as "<cmd> <n> (<id> <index> <value>)*n",
+   up to 20 changes per report, so one report can carry updates to many. s_sent only takes what
+   was queued: a report the full transmit queue refused stays dirty and is tried again. */
+static void rawhid_shadow_flush(t_rawhid *x)
+{
+	unsigned char frame[RAWHID_BLOCK_SIZE];
+	t_rawhid_shadow *sh;
+	int i, j, n = 0, kept = 0;
+
+	if (!x->x_isOpen)
+		return;
+	for (i = 0; i < x->x_ndirty; i++) {
+		sh = x->x_shadow[x->x_dirty[i]];
+		if (sh->s_valid && !memcmp(sh->s_state, sh->s_sent, RAWHID_BLOCK_SIZE))
+			continue;
+		if (x->x_deltacmd < 0 || !sh->s_valid) {
+			if (write_frame(x, sh->s_state, RAWHID_LANE_RT) < 0)
+				continue;
+			memcpy(sh->s_sent, sh->s_state, RAWHID_BLOCK_SIZE);
+			sh->s_valid = 1;
+			continue;
+		}
+		for (j = 1; j < RAWHID_BLOCK_SIZE; j++) {
+			if (sh->s_state[j] == sh->s_sent[j])
+				continue;
+			if (2 + 3 * (n + 1) > RAWHID_BLOCK_SIZE) {
+				if (write_frame(x, frame, RAWHID_LANE_RT) >= 0)
+					rawhid_shadow_sent(x, frame);
+				n = 0;
+			}
+			if (!n) {
+				memset(frame, 0, RAWHID_BLOCK_SIZE);
+				frame[0] = x->x_deltacmd;
+			}
+			frame[2 + 3 * n] = sh->s_state[0];
+			frame[3 + 3 * n] = j;
+			frame[4 + 3 * n] = sh->s_state[j];
+			frame[1] = ++n;
+		}
+	}
+	if (n && write_frame(x, frame, RAWHID_LANE_RT) >= 0)
+		rawhid_shadow_sent(x, frame);
+	for (i = 0; i < x->x_ndirty; i++) {
+		sh = x->x_shadow[x->x_dirty[i]];
+		if (sh->s_valid && !memcmp(sh->s_state, sh->s_sent, RAWHID_BLOCK_SIZE))
+			sh->s_dirty = 0;
+		else
+			x->x_dirty[kept++] = x->x_dirty[i];
+	}
+	x->x_ndirty = kept;
+	if (kept)
+		clock_delay(x->x_shadowclock, RAWHID_SHADOW_RETRY);
+}
+
+/* delta <cmd> : send shadow changes as packed delta reports with report ID <cmd>, -1 for off */
+static void rawhid_delta(t_rawhid *x, t_float cmd)
+{
+	x->x_deltacmd = (cmd >= 0 && cmd < RAWHID_MAX_IDS) ? (int)cmd : -1;
+}
+
+/* template <id> <byte or slot> ... : registers a report layout for 'fire'. Numbers are fixed
+   bytes, symbols are slots (see rawhid_slot_parse). Without layout the template is removed. */
+static void rawhid_template(t_rawhid *x, t_symbol *s, int argc, t_atom *argv)
+{
+	t_rawhid_template *t;
+	int id = (int)atom_getfloatarg(0, argc, argv);
+
+	if (id < 0 || id >= RAWHID_MAX_IDS) {
+		pd_error(x, "[rawhid] template: id %d out of range 0..%d", id, RAWHID_MAX_IDS - 1);
+		return;
+	}
+	if (x->x_templates[id]) {
+		freebytes(x->x_templates[id], sizeof(*x->x_templates[id]));
+		x->x_templates[id] = NULL;
+	}
+	if (argc < 2)
+		return;
+	t = (t_rawhid_template *)getbytes(sizeof(*t));
+	if (!rawhid_layout_parse(x, "[rawhid] template:", t, argc - 1, argv + 1)) {
+		freebytes(t, sizeof(*t));
+		return;
+	}
+	x->x_templates[id] = t;
+}
+
+/* fire <id> <values...> : sends template <id> with its slots filled in order. Missing values
+   leave a slot at 0. */
+static void rawhid_fire(t_rawhid *x, t_symbol *s, int argc, t_atom *argv)
+{
+	unsigned char frame[RAWHID_BLOCK_SIZE];
+	t_rawhid_template *t;
+	int id = (int)atom_getfloatarg(0, argc, argv);
+	int i;
+
+	if (id < 0 || id >= RAWHID_MAX_IDS || !(t = x->x_templates[id])) {
+		pd_error(x, "[rawhid] fire: no template %d", id);
+		return;
+	}
+	if (!x->x_isOpen) {
+		RAWHID_LOG(x, RAWHID_LOG_WARN, "Serial port is not open");
+		return;
+	}
+	memcpy(frame, t->t_frame, RAWHID_BLOCK_SIZE);
+	for (i = 0; i < t->t_nslots; i++)
+		rawhid_slot_write(&t->t_slots[i], frame, atom_getfloatarg(i + 1, argc, argv));
+	write_frame(x, frame, RAWHID_LANE_RT);
+}
+
+static double rawhid_slot_read(const t_rawhid_slot *slot, const unsigned char *buf)
+{
+	uint32_t v = 0;
+	float f;
+	int j;
+
+	for (j = 0; j < slot->s_size; j++)
+		v |= (uint32_t)buf[slot->s_offset + (slot->s_bigend ? slot->s_size - 1 - j : j)]
+		     << (8 * j);
+	if (slot->s_float) {
+		memcpy(&f, &v, sizeof(f));
+		return f;
+	}
+	if (!slot->s_signed)
+		return v;
+	if (slot->s_size < 4 && (v >> (8 * slot->s_size - 1)) & 1)
+		v |= ~0u << (8 * slot->s_size);
+	return (int32_t)v;
+}
+
+/* Folds the fields of one report into the decoder's window, and outputs them as a list when the
+   window is full. */
+static void rawhid_decode_report(t_rawhid *x, t_rawhid_decoder *d, t_outlet *out,
+				 unsigned char *buf)
+{
+	double *acc = d->d_acc, a = x->x_decalpha, v;
+	int i, n = d->d_layout.t_nslots, first = !d->d_count++;
+
+	switch (x->x_decmode) {
+	case RAWHID_DEC_MEAN:
+		for (i = 0; i < n; i++)
+			acc[i] = (first ? 0 : acc[i]) + rawhid_slot_read(d->d_layout.t_slots + i, buf);
+		break;
+	case RAWHID_DEC_MIN:
+		for (i = 0; i < n; i++) {
+			v = rawhid_slot_read(d->d_layout.t_slots + i, buf);
+			acc[i] = (first || v < acc[i]) ? v : acc[i];
+		}
+		break;
+	case RAWHID_DEC_MAX:
+		for (i = 0; i < n; i++) {
+			v = rawhid_slot_read(d->d_layout.t_slots + i, buf);
+			acc[i] = (first || v > acc[i]) ? v : acc[i];
+		}
+		break;
+	case RAWHID_DEC_LAST:
+		for (i = 0; i < n; i++)
+			acc[i] = rawhid_slot_read(d->d_layout.t_slots + i, buf);
+		break;
+	case RAWHID_DEC_SMOOTH:
+		for (i = 0; i < n; i++) {
+			v = rawhid_slot_read(d->d_layout.t_slots + i, buf);
+			acc[i] = d->d_primed ? acc[i] + a * (v - acc[i]) : v;
+		}
+		d->d_primed = 1;
+		break;
+	}
+	if (d->d_count < x->x_decwindow)
+		return;
+	if (n > x->x_outsize) {
+		x->x_outatoms = (t_atom *)resizebytes(x->x_outatoms, x->x_outsize * sizeof(t_atom),
+						      n * sizeof(t_atom));
+		x->x_outsize = n;
+	}
+	for (i = 0; i < n; i++)
+		SETFLOAT(x->x_outatoms + i,
+			 x->x_decmode == RAWHID_DEC_MEAN ? acc[i] / d->d_count : acc[i]);
+	d->d_count = 0;
+	outlet_list(out, &s_list, n, x->x_outatoms);
+}
+
+/* decode <id> <byte or slot> ... : reports starting with <id> are output as a list of their
+   slots' values instead of their bytes, see 'decimate'. A number stands for a byte that is
+   skipped, a symbol for a slot as in 'template'. Without layout the decoder is removed. */
+static void rawhid_decode(t_rawhid *x, t_symbol *s, int argc, t_atom *argv)
+{
+	t_rawhid_decoder *d;
+	int id = (int)atom_getfloatarg(0, argc, argv);
+
+	if (id < 0 || id >= RAWHID_MAX_IDS) {
+		pd_error(x, "[rawhid] decode: id %d out of range 0..%d", id, RAWHID_MAX_IDS - 1);
+		return;
+	}
+	if (x->x_decoders[id]) {
+		freebytes(x->x_decoders[id], sizeof(*x->x_decoders[id]));
+		x->x_decoders[id] = NULL;
+	}
+	if (argc < 2)
+		return;
+	d = (t_rawhid_decoder *)getbytes(sizeof(*d));
+	if (!rawhid_layout_parse(x, "[rawhid] decode:", &d->d_layout, argc - 1, argv + 1)) {
+		freebytes(d, sizeof(*d));
+		return;
+	}
+	x->x_decoders[id] = d;
+}
+
+/* decimate <reports> [mean|min|max|last|smooth [<coef>]] : decoded reports are summarised per
+   field over windows of <reports>, one list per window. smooth runs each field through a one-pole
+   lowpass, y += coef * (x - y), and outputs its state. 1 outputs every report. */
+static void rawhid_decimate(t_rawhid *x, t_symbol *s, int argc, t_atom *argv)
+{
+	static const char *modes[] = {"mean", "min", "max", "last", "smooth"};
+	int window = (int)atom_getfloatarg(0, argc, argv);
+	t_symbol *mode = atom_getsymbolarg(1, argc, argv);
+	double alpha = argc > 2 ? atom_getfloatarg(2, argc, argv) : 0.1;
+	int i;
+
+	if (window < 1 || alpha <= 0 || alpha > 1) {
+		pd_error(x, "[rawhid] decimate: expected <reports> >= 1 and 0 < coef <= 1");
+		return;
+	}
+	if (mode != &s_) {
+		for (i = 0; i < 5 && strcmp(mode->s_name, modes[i]); i++)
+			;
+		if (i == 5) {
+			pd_error(x, "[rawhid] decimate: unknown mode '%s', expected mean, min, max, "
+				    "last or smooth", mode->s_name);
+			return;
+		}
+		x->x_decmode = i;
+	}
+	x->x_decwindow = window;
+	x->x_decalpha = alpha;
+	for (i = 0; i < RAWHID_MAX_IDS; i++) {
+		if (x->x_decoders[i])
+			x->x_decoders[i]->d_count = x->x_decoders[i]->d_primed = 0;
+	}
+	post("[rawhid] Decoded fields: %s of every %d reports", modes[x->x_decmode], window);
+}
+
+/* listmode 1 : output each report as a single list */
+static void rawhid_listmode(t_rawhid *x, t_float on)
+{
+	x->x_listmode = (on != 0);
+	post("[rawhid] List output %s", x->x_listmode ? "on" : "off");
+}
+
+/* filter <id> ... : only deliver reports whose first byte is listed. No arguments clears it. */
+static void rawhid_filter(t_rawhid *x, t_symbol *s, int argc, t_atom *argv)
+{
+	int i;
+
+	memset(x->x_accept, 0, sizeof(x->x_accept));
+	x->x_naccept = 0;
+	for (i = 0; i < argc; i++) {
+		int id = (int)atom_getfloat(argv + i);
+		if (id < 0 || id >= RAWHID_MAX_IDS) {
+			pd_error(x, "[rawhid] filter: invalid report id %d", id);
+			continue;
+		}
+		x->x_naccept += !x->x_accept[id];
+		x->x_accept[id] = 1;
+	}
+	post("[rawhid] Filter set to %d report ids", x->x_naccept);
+}
+
+/* backend <name> : the device layer the next 'open' uses, e.g. hidraw or sim. Without a name it
+   lists the registered backends. */
+static void rawhid_backend(t_rawhid *x, t_symbol *s, int argc, t_atom *argv)
+{
+	const rawhid_backend_t *b;
+	int i;
+
+	if (!argc) {
+		for (i = 0; i < rawhid_nbackends; i++)
+			post("[rawhid] backend %s%s", rawhid_backends[i]->name,
+			     rawhid_backends[i] == x->x_backend ? " (selected)" : "");
+		return;
+	}
+	b = rawhid_backend_find(atom_getsymbolarg(0, argc, argv)->s_name);
+	if (!b) {
+		pd_error(x, "[rawhid] backend: unknown backend %s",
+			 atom_getsymbolarg(0, argc, argv)->s_name);
+		return;
+	}
+	x->x_backend = b;
+	post("[rawhid] Backend set to %s%s", b->name, x->x_hub ? ", used from the next open" : "");
+}
+
+/* log : prints the recent events of all [rawhid] objects, oldest first. 'log clear' empties it. */
+static void rawhid_logdump(t_rawhid *x, t_symbol *s, int argc, t_atom *argv)
+{
+	static const char *levels[] = { "", "error", "warning", "info", "debug" };
+	unsigned long i = (rawhid_log_count > RAWHID_LOG_RING) ? rawhid_log_count - RAWHID_LOG_RING
+							       : 0;
+
+	if (atom_getsymbolarg(0, argc, argv) == gensym("clear")) {
+		rawhid_log_count = 0;
+		rawhid_log_suppressed = 0;
+		post("[rawhid] log cleared");
+		return;
+	}
+	for (; i < rawhid_log_count; i++) {
+		t_rawhid_logentry *e = &rawhid_log_ring[i % RAWHID_LOG_RING];
+		post("[rawhid] log: %.0f ms ago, %s: %s", clock_gettimesince(e->e_time),
+		     levels[e->e_level], e->e_text);
+	}
+	post("[rawhid] log: %lu events, %lu suppressed by rate limiting", rawhid_log_count,
+	     rawhid_log_suppressed);
+}
+
+/* the 'constructor' method which defines the t_rawhid struct for this
+   instance and returns it to the caller which is the Pd core.
+   Creation arguments (e.g. [rawhid 1 2 7]) create one outlet per report ID, in order. */
+static void *rawhid_new(t_symbol *s, int argc, t_atom *argv)
+{
+	int i;
+
+	post("[rawhid] Starting ...");
+	t_rawhid *x = (t_rawhid *)pd_new(rawhid_class);
+
+	x->x_inbuf = getbytes(RAWHID_BUF_SIZE);
+	x->x_outbuf = getbytes(RAWHID_BUF_SIZE);
+	if (NULL == x->x_inbuf || NULL == x->x_outbuf) {
+		pd_error(x, "[rawhid] fatal error : unable to allocate buffer");
+		return 1;
+	}
+	x->x_inbuf_len = RAWHID_BUF_SIZE;
+	x->x_outbuf_len = RAWHID_BUF_SIZE;
+	x->x_outbuf_wr_index = 0;
+	x->x_data_outlet = NULL;
+	x->x_nroutes = 0;
+	memset(x->x_route, 0, sizeof(x->x_route));
+	for (i = 0; i < argc; i++) {
+		int id = (int)atom_getfloat(argv + i);
+		if (argv[i].a_type != A_FLOAT || id < 0 || id >= RAWHID_MAX_IDS) {
+			pd_error(x, "[rawhid] invalid report id argument #%d, expected 0..255", i + 1);
+			continue;
+		}
+		if (x->x_route[id]) {
+			pd_error(x, "[rawhid] report id %d given twice, ignoring", id);
+			continue;
+		}
+		x->x_route[id] = outlet_new(&x->x_obj, &s_float);
+		x->x_nroutes++;
+	}
+	if (!x->x_nroutes) {
+		x->x_data_outlet = outlet_new(&x->x_obj, &s_float);
+	}
+	x->x_info_outlet = outlet_new(&x->x_obj, 0);
+	x->x_resp_outlet = outlet_new(&x->x_obj, 0);
+	rawhid_cache_acquire();
+	x->x_reconnect = 0;
+	x->x_txrate = 0;
+	x->x_txburst = 1;
+	x->x_rxsize = RAWHID_RXQ_DEFAULT;
+	x->x_rxpolicy = RAWHID_RX_DROP_OLDEST;
+	x->x_listmode = 0;
+	x->x_seqpos = 1;
+	x->x_seqoff = -1;
+	x->x_seqsize = 1;
+	x->x_seqbig = 0;
+	x->x_frameoff = -1;
+	x->x_outatoms = (t_atom *)getbytes(RAWHID_BLOCK_SIZE * sizeof(t_atom));
+	x->x_outsize = RAWHID_BLOCK_SIZE;
+	x->x_reqtimeout = RAWHID_REQ_TIMEOUT;
+	memset(x->x_shadow, 0, sizeof(x->x_shadow));
+	x->x_ndirty = 0;
+	x->x_deltacmd = -1;
+	x->x_shadowclock = clock_new(x, (t_method)rawhid_shadow_flush);
+	memset(x->x_templates, 0, sizeof(x->x_templates));
+	memset(x->x_decoders, 0, sizeof(x->x_decoders));
+	x->x_decwindow = 1;
+	x->x_decmode = RAWHID_DEC_LAST;
+	x->x_decalpha = 0.1;
+	x->x_packets_to_recv = 1; // default = 1
+	/* Since 10ms is also the default poll time for most HID devices,
+	 * and it seems that for most uses of [comport] (i.e. arduinos and
+	 * other serial ports 115200 baud or less) that 10ms polling is
+	 * going to give the data as fast as 1ms polling with a lot less
+	 * CPU time wasted. */
+	x->x_deltime = 1000;
+	x->x_hub = NULL;
+	x->x_next_sub = NULL;
+	x->x_backend = rawhid_backends[0];
+	x->x_isOpen = 0;
+	x->x_naccept = 0;
+	memset(x->x_accept, 0, sizeof(x->x_accept));
+	post("[rawhid] Successfully started");
+	return (void *)x;
+}
+
+static void rawhid_free(t_rawhid *x)
+{
+	int i;
+
+	post("[rawhid] free rawhid...");
+	rawhid_hub_unsubscribe(x);
+	rawhid_cache_release();
+	clock_free(x->x_shadowclock);
+	for (i = 0; i < RAWHID_MAX_IDS; i++) {
+		if (x->x_shadow[i])
+			freebytes(x->x_shadow[i], sizeof(*x->x_shadow[i]));
+		if (x->x_templates[i])
+			freebytes(x->x_templates[i], sizeof(*x->x_templates[i]));
+		if (x->x_decoders[i])
+			freebytes(x->x_decoders[i], sizeof(*x->x_decoders[i]));
+	}
+	freebytes(x->x_inbuf, x->x_inbuf_len);
+	freebytes(x->x_outbuf, x->x_outbuf_len);
+	freebytes(x->x_outatoms, x->x_outsize * sizeof(t_atom));
+}
+
+/* This method is the only one the Pd core expects to be present */
+
+#if defined(_LANGUAGE_C_PLUS_PLUS) || defined(__cplusplus)
+extern "C" {
+#endif
+void rawhid_setup(void)
+{
+	/* this registers the 'rawhid' class. The 'rawhid_new' method will be executed at each
+	instantiation. */
+	rawhid_class = class_new(gensym("rawhid"), (t_newmethod)(t_method)rawhid_new,
+				 (t_method)rawhid_free, sizeof(t_rawhid),
+				 CLASS_DEFAULT, A_GIMME, 0);
+
+	rawhid_backend_register(&rawhid_native_backend);
+	rawhid_backend_register(&rawhid_sim_backend);
+	rawhid_simd_init();
+	DEBUG_POST(("[rawhid] using %s conversion kernels", rawhid_simd_name()));
+
+	class_addfloat(rawhid_class, (t_method)rawhid_float);
+	class_addlist(rawhid_class, (t_method)rawhid_list);
+	class_addmethod(rawhid_class, (t_method)rawhid_open_device, gensym("open"), A_GIMME, 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_cache_list, gensym("devices"), 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_poll, gensym("poll"), A_FLOAT, 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_packets, gensym("packets"), A_FLOAT, 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_sendtable, gensym("sendtable"), A_SYMBOL,
+			A_DEFFLOAT, A_DEFFLOAT, 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_txrate, gensym("txrate"), A_FLOAT,
+			A_DEFFLOAT, 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_txstat, gensym("txstat"), 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_rxqueue, gensym("rxqueue"), A_GIMME, 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_rxstat, gensym("rxstat"), 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_rtprio, gensym("rtprio"), A_GIMME, 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_affinity, gensym("affinity"), A_GIMME, 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_iolatency, gensym("iolatency"), A_GIMME, 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_bulk, gensym("bulk"), A_GIMME, 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_request, gensym("request"), A_GIMME, 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_seqpos, gensym("seqpos"), A_FLOAT, 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_timeout, gensym("timeout"), A_FLOAT, 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_seqcheck, gensym("seqcheck"), A_GIMME, 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_seqstat, gensym("seqstat"), 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_crccheck, gensym("crc"), A_GIMME, 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_crcstat, gensym("crcstat"), 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_framing, gensym("framing"), A_GIMME, 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_decode, gensym("decode"), A_GIMME, 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_decimate, gensym("decimate"), A_GIMME, 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_shadow, gensym("shadow"), A_GIMME, 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_delta, gensym("delta"), A_FLOAT, 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_template, gensym("template"), A_GIMME, 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_fire, gensym("fire"), A_GIMME, 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_listmode, gensym("listmode"), A_FLOAT, 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_reconnect, gensym("reconnect"), A_FLOAT, 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_filter, gensym("filter"), A_GIMME, 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_backend, gensym("backend"), A_GIMME, 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_logdump, gensym("log"), A_GIMME, 0);
+	class_addmethod(rawhid_class, (t_method)rawhid_close_device, gensym("close"), 0);
+
+	/* the port [rawhid_out~] sends through, see rawhid_port.h */
+	rawhid_port_class = class_new(gensym("rawhid port"), 0, 0, sizeof(t_pd), CLASS_PD, 0);
+	class_addmethod(rawhid_port_class, (t_method)rawhid_port_queue, gensym("queue"), A_CANT,
+			0);
+	rawhid_port = pd_new(rawhid_port_class);
+	pd_bind(rawhid_port, gensym(RAWHID_PORT));
 }
 #if defined(_LANGUAGE_C_PLUS_PLUS) || defined(__cplusplus)
 }
@@ -0,0 +1,199 @@
+/* CRC engine for the integrity check of inbound reports in the RAWHID Pd External.
+ *
+ *  rawhid_crc_init - build the tables of a CRC-8, CRC-16 or CRC-32 with any polynomial
+ *  rawhid_crc - checksum of a buffer
+ *
+ * Parameters follow the usual catalogue notation: the polynomial without its top bit, an initial
+ * value and a final xor as they would be printed, and whether input and output are reflected.
+ * The tables are slicing-by-8, eight bytes per step with no dependency between the lookups. The
+ * CRC-32C (and on ARM also CRC-32) polynomial is computed with the CPU's CRC instructions where
+ * it has them, chosen at run time on x86 like the AVX2 kernels of rawhid_simd.hpp.
+ */
+
+#include <stdint.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+#define RAWHID_HAVE_SSE42_CRC 1
+#endif
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define RAWHID_HAVE_ARM_CRC 1
+#endif
+
+#define RAWHID_CRC32_POLY 0x04C11DB7
+#define RAWHID_CRC32C_POLY 0x1EDC6F41
+
+typedef struct _rawhid_crc t_rawhid_crc;
+typedef uint32_t (*t_rawhid_crc_run)(const t_rawhid_crc *c, uint32_t reg, const unsigned char *p,
+				     int n);
+
+struct _rawhid_crc {
+	int 		c_width; /* 8, 16 or 32 */
+	int 		c_refl;
+	uint32_t 	c_poly;
+	uint32_t 	c_init;
+	uint32_t 	c_xorout;
+	uint32_t 	c_start; /* c_init as the register holds it */
+	t_rawhid_crc_run c_run;
+	const char *	c_kernel; /* name of c_run */
+	uint32_t 	c_table[8][256];
+};
+
+static uint32_t rawhid_crc_reflect(uint32_t v, int width)
+{
+	uint32_t r = 0;
+	int i;
+
+	for (i = 0; i < width; i++, v >>= 1)
+		r = (r << 1) | (v & 1);
+	return r;
+}
+
+static uint32_t rawhid_crc_le32(const unsigned char *p)
+{
+	return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint32_t rawhid_crc_be32(const unsigned char *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+/* Reflected CRCs shift right, with the register in the low c_width bits. */
+static uint32_t rawhid_crc_run_refl(const t_rawhid_crc *c, uint32_t reg, const unsigned char *p,
+				    int n)
+{
+	const uint32_t(*t)[256] = c->c_table;
+
+	for (; n >= 8; n -= 8, p += 8) {
+		uint32_t a = reg ^ rawhid_crc_le32(p), b = rawhid_crc_le32(p + 4);
+		reg = t[7][a & 0xFF] ^ t[6][(a >> 8) & 0xFF] ^ t[5][(a >> 16) & 0xFF] ^ t[4][a >> 24] ^
+		      t[3][b & 0xFF] ^ t[2][(b >> 8) & 0xFF] ^ t[1][(b >> 16) & 0xFF] ^ t[0][b >> 24];
+	}
+	for (; n > 0; n--, p++)
+		reg = (reg >> 8) ^ t[0][(reg ^ *p) & 0xFF];
+	return reg;
+}
+
+/* The others shift left, with the register in the top c_width bits. */
+static uint32_t rawhid_crc_run_msb(const t_rawhid_crc *c, uint32_t reg, const unsigned char *p,
+				   int n)
+{
+	const uint32_t(*t)[256] = c->c_table;
+
+	for (; n >= 8; n -= 8, p += 8) {
+		uint32_t a = reg ^ rawhid_crc_be32(p), b = rawhid_crc_be32(p + 4);
+		reg = t[7][a >> 24] ^ t[6][(a >> 16) & 0xFF] ^ t[5][(a >> 8) & 0xFF] ^ t[4][a & 0xFF] ^
+		      t[3][b >> 24] ^ t[2][(b >> 16) & 0xFF] ^ t[1][(b >> 8) & 0xFF] ^ t[0][b & 0xFF];
+	}
+	for (; n > 0; n--, p++)
+		reg = (reg << 8) ^ t[0][(reg >> 24) ^ *p];
+	return reg;
+}
+
+#ifdef RAWHID_HAVE_SSE42_CRC
+__attribute__((target("sse4.2"))) static uint32_t rawhid_crc_run_sse42(const t_rawhid_crc *c,
+								      uint32_t reg,
+								      const unsigned char *p, int n)
+{
+	for (; n >= 4; n -= 4, p += 4)
+		reg = _mm_crc32_u32(reg, rawhid_crc_le32(p));
+	for (; n > 0; n--, p++)
+		reg = _mm_crc32_u8(reg, *p);
+	return reg;
+}
+#endif
+
+#ifdef RAWHID_HAVE_ARM_CRC
+static uint32_t rawhid_crc_run_arm32(const t_rawhid_crc *c, uint32_t reg, const unsigned char *p,
+				     int n)
+{
+	for (; n >= 4; n -= 4, p += 4)
+		reg = __crc32w(reg, rawhid_crc_le32(p));
+	for (; n > 0; n--, p++)
+		reg = __crc32b(reg, *p);
+	return reg;
+}
+
+static uint32_t rawhid_crc_run_arm32c(const t_rawhid_crc *c, uint32_t reg, const unsigned char *p,
+				      int n)
+{
+	for (; n >= 4; n -= 4, p += 4)
+		reg = __crc32cw(reg, rawhid_crc_le32(p));
+	for (; n > 0; n--, p++)
+		reg = __crc32cb(reg, *p);
+	return reg;
+}
+#endif
+
+static void rawhid_crc_init(t_rawhid_crc *c, int width, uint32_t poly, uint32_t init,
+			    uint32_t xorout, int refl)
+{
+	uint32_t mask = (width == 32) ? 0xFFFFFFFF : (1u << width) - 1;
+	uint32_t top, r;
+	int i, j, k;
+
+	c->c_width = width;
+	c->c_refl = refl;
+	c->c_poly = poly & mask;
+	c->c_init = init & mask;
+	c->c_xorout = xorout & mask;
+	if (refl) {
+		top = rawhid_crc_reflect(c->c_poly, width);
+		for (i = 0; i < 256; i++) {
+			for (r = i, j = 0; j < 8; j++)
+				r = (r & 1) ? (r >> 1) ^ top : r >> 1;
+			c->c_table[0][i] = r;
+		}
+		for (k = 1; k < 8; k++)
+			for (i = 0; i < 256; i++) {
+				r = c->c_table[k - 1][i];
+				c->c_table[k][i] = (r >> 8) ^ c->c_table[0][r & 0xFF];
+			}
+		c->c_start = rawhid_crc_reflect(c->c_init, width);
+		c->c_run = rawhid_crc_run_refl;
+	} else {
+		top = c->c_poly << (32 - width);
+		for (i = 0; i < 256; i++) {
+			for (r = (uint32_t)i << 24, j = 0; j < 8; j++)
+				r = (r & 0x80000000) ? (r << 1) ^ top : r << 1;
+			c->c_table[0][i] = r;
+		}
+		for (k = 1; k < 8; k++)
+			for (i = 0; i < 256; i++) {
+				r = c->c_table[k - 1][i];
+				c->c_table[k][i] = (r << 8) ^ c->c_table[0][r >> 24];
+			}
+		c->c_start = c->c_init << (32 - width);
+		c->c_run = rawhid_crc_run_msb;
+	}
+	c->c_kernel = "slicing-by-8";
+	if (width != 32 || !refl)
+		return;
+#ifdef RAWHID_HAVE_SSE42_CRC
+	__builtin_cpu_init();
+	if (c->c_poly == RAWHID_CRC32C_POLY && __builtin_cpu_supports("sse4.2")) {
+		c->c_run = rawhid_crc_run_sse42;
+		c->c_kernel = "sse4.2";
+	}
+#endif
+#ifdef RAWHID_HAVE_ARM_CRC
+	if (c->c_poly == RAWHID_CRC32_POLY) {
+		c->c_run = rawhid_crc_run_arm32;
+		c->c_kernel = "armv8 crc";
+	} else if (c->c_poly == RAWHID_CRC32C_POLY) {
+		c->c_run = rawhid_crc_run_arm32c;
+		c->c_kernel = "armv8 crc";
+	}
+#endif
+}
+
+static uint32_t rawhid_crc(const t_rawhid_crc *c, const unsigned char *p, int n)
+{
+	uint32_t reg = c->c_run(c, c->c_start, p, n);
+
+	if (!c->c_refl)
+		reg >>= 32 - c->c_width;
+	return reg ^ c->c_xorout;
+}
@@ -0,0 +1,104 @@
+/* Report layouts for the RAWHID Pd External, shared by [rawhid] and [rawhid_out~].
+ *
+ *  rawhid_slot_parse - parse a slot type such as "u8", "s16be" or "f32"
+ *  rawhid_layout_parse - build a template from fixed bytes and slots
+ *  rawhid_slot_write - store a value into its slot of a report
+ *
+ * Each object is built into its own binary, so both get a copy of these.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RAWHID_BLOCK_SIZE 64 /* bytes in every report sent or received */
+
+/* A value slot in a template, where 'fire' writes its argument, or in a decode layout. */
+typedef struct _rawhid_slot {
+	unsigned char 	s_offset;
+	unsigned char 	s_size;   /* 1, 2, 3 or 4 bytes */
+	unsigned char 	s_bigend;
+	unsigned char 	s_float;  /* IEEE 754 single instead of an integer */
+	unsigned char 	s_signed; /* two's complement, read with sign extension */
+} t_rawhid_slot;
+
+/* A report with its fixed bytes encoded once, and the slots 'fire' fills in. 'decode' reads the
+   slots of the same layout back, skipping the fixed bytes. */
+typedef struct _rawhid_template {
+	unsigned char 	t_frame[RAWHID_BLOCK_SIZE];
+	t_rawhid_slot 	t_slots[RAWHID_BLOCK_SIZE];
+	int 		t_nslots;
+	int 		t_len; /* bytes the layout covers */
+} t_rawhid_template;
+
+/* Parses a slot type such as "u8", "s16", "u24be" or "f32": signedness only matters to the
+   patch, the value is written in two's complement. Little endian unless suffixed with "be". */
+static int rawhid_slot_parse(const char *name, t_rawhid_slot *slot)
+{
+	char *end;
+	long bits;
+
+	if (name[0] != 'u' && name[0] != 's' && name[0] != 'f')
+		return 0;
+	bits = strtol(name + 1, &end, 10);
+	if (bits != 8 && bits != 16 && bits != 24 && bits != 32)
+		return 0;
+	if (name[0] == 'f' && bits != 32)
+		return 0;
+	if (*end && strcmp(end, "le") && strcmp(end, "be"))
+		return 0;
+	slot->s_size = bits / 8;
+	slot->s_bigend = !strcmp(end, "be");
+	slot->s_float = (name[0] == 'f');
+	slot->s_signed = (name[0] == 's');
+	return 1;
+}
+
+/* Fills a zeroed template from a layout of fixed bytes (numbers) and slots (symbols). Errors are
+   reported for owner, after the prefix what; returns 0 then. */
+static int rawhid_layout_parse(void *owner, const char *what, t_rawhid_template *t, int argc,
+			       t_atom *argv)
+{
+	t_rawhid_slot slot;
+	int i, len = 0;
+
+	for (i = 0; i < argc; i++) {
+		if (argv[i].a_type == A_FLOAT) {
+			slot.s_size = 1;
+		} else if (!rawhid_slot_parse(atom_getsymbol(argv + i)->s_name, &slot)) {
+			pd_error(owner, "%s unknown slot type '%s'", what,
+				 atom_getsymbol(argv + i)->s_name);
+			return 0;
+		}
+		if (len + slot.s_size > RAWHID_BLOCK_SIZE) {
+			pd_error(owner, "%s layout longer than %d bytes", what, RAWHID_BLOCK_SIZE);
+			return 0;
+		}
+		if (argv[i].a_type == A_FLOAT) {
+			t->t_frame[len] = (unsigned char)atom_getfloat(argv + i);
+		} else {
+			slot.s_offset = len;
+			t->t_slots[t->t_nslots++] = slot;
+		}
+		len += slot.s_size;
+	}
+	t->t_len = len;
+	return 1;
+}
+
+static void rawhid_slot_write(const t_rawhid_slot *slot, unsigned char *frame, t_float f)
+{
+	uint32_t v;
+	int j;
+
+	if (slot->s_float) {
+		float fv = f;
+		memcpy(&v, &fv, sizeof(v));
+	} else {
+		v = (uint32_t)(int64_t)f;
+	}
+	for (j = 0; j < slot->s_size; j++) {
+		int at = slot->s_bigend ? slot->s_size - 1 - j : j;
+		frame[slot->s_offset + at] = (v >> (8 * j)) & 0xFF;
+	}
+}
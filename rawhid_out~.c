@@ -0,0 +1,232 @@
+// [rawhid_out~] for the RAWHID Pd External.
+//
+// Streams signals to a device that a [rawhid] has open. The reports go through the port rawhid
+// binds when it is loaded (see rawhid_port.h), so this object loads on its own and simply drops
+// reports until a [rawhid] exists and has the device open.
+
+#include "m_pd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rawhid_layout.hpp"
+#include "rawhid_port.h"
+
+#define RAWHID_OUT_RING 32 /* reports held between the DSP tick and the clock */
+#define RAWHID_OUT_WARN 1000 /* ms between warnings about dropped reports */
+
+/* [rawhid_out~ <vid> <pid> <byte or slot> ...] : packs its signal inlets, one per slot of the
+   layout, into a report every x_every DSP blocks, so the report rate follows the audio clock. The
+   DSP tick only writes the report into a ring inside the object, which neither allocates nor
+   logs; a clock hands the ring to the port, which queues it on the device's rt lane, where the
+   tx clock sends it under the same token bucket as everything else. */
+static t_class *rawhid_out_class;
+static t_symbol *rawhid_out_port;
+static t_symbol *rawhid_out_queue;
+
+typedef struct _rawhid_out {
+	t_object 	x_obj;
+	t_float 	x_f;
+	int 		x_vid;
+	int 		x_pid;
+	t_symbol *	x_backend; /* of the [rawhid] to send through, NULL for the platform's own */
+	t_rawhid_template x_layout;
+	int 		x_nin;  /* signal inlets, one per slot but at least one */
+	t_sample **	x_in;   /* their vectors, set by the dsp method */
+	int 		x_every; /* DSP blocks per report */
+	int 		x_mean;  /* average each period instead of taking its last sample */
+	int 		x_blocks; /* blocks into the current period */
+	int 		x_samples;
+	double 		x_acc[RAWHID_BLOCK_SIZE];
+	unsigned char 	x_ring[RAWHID_OUT_RING][RAWHID_BLOCK_SIZE]; /* filled by perform */
+	int 		x_head;
+	int 		x_count;
+	t_clock *	x_clock; /* drains the ring */
+	unsigned long 	x_sent;
+	unsigned long 	x_dropped;
+	unsigned long 	x_logged;  /* x_dropped when the clock last warned */
+	double 		x_logtime; /* and when */
+} t_rawhid_out;
+
+static int rawhid_out_setdevice(t_rawhid_out *x, t_symbol *vid, t_symbol *pid)
+{
+	if (strncmp(vid->s_name, "0x", 2) || strncmp(pid->s_name, "0x", 2)) {
+		pd_error(x, "[rawhid_out~] expected device ids like 0x16c0 0x0486");
+		return 0;
+	}
+	x->x_vid = (int)strtol(vid->s_name, NULL, 16);
+	x->x_pid = (int)strtol(pid->s_name, NULL, 16);
+	return 1;
+}
+
+/* Packs the period's values into the next free slot of the ring. Called from perform, so a full
+   ring only counts the report as dropped. */
+static void rawhid_out_pack(t_rawhid_out *x)
+{
+	t_rawhid_template *t = &x->x_layout;
+	unsigned char *frame;
+	int i;
+
+	if (x->x_count == RAWHID_OUT_RING) {
+		x->x_dropped++;
+		return;
+	}
+	frame = x->x_ring[(x->x_head + x->x_count) % RAWHID_OUT_RING];
+	memcpy(frame, t->t_frame, RAWHID_BLOCK_SIZE);
+	for (i = 0; i < t->t_nslots; i++)
+		rawhid_slot_write(&t->t_slots[i], frame,
+				  x->x_mean ? x->x_acc[i] / x->x_samples : x->x_acc[i]);
+	x->x_count++;
+	clock_delay(x->x_clock, 0);
+}
+
+/* Clock: hands the packed reports to the port. Without a [rawhid] that has the device open, or
+   with its lane at the limit, a report is dropped rather than held back. */
+static void rawhid_out_tick(t_rawhid_out *x)
+{
+	t_pd *port = rawhid_out_port->s_thing;
+	t_rawhid_port_queue queue = NULL;
+
+	if (port)
+		queue = (t_rawhid_port_queue)(t_method)zgetfn(port, rawhid_out_queue);
+	for (; x->x_count; x->x_count--, x->x_head = (x->x_head + 1) % RAWHID_OUT_RING) {
+		if (queue && queue(port, x->x_backend, x->x_vid, x->x_pid, x->x_ring[x->x_head]))
+			x->x_sent++;
+		else
+			x->x_dropped++;
+	}
+	if (x->x_dropped != x->x_logged &&
+	    (!x->x_logtime || clock_gettimesince(x->x_logtime) >= RAWHID_OUT_WARN)) {
+		logpost(x, 2, "[rawhid_out~] %lu reports dropped, device 0x%04x 0x%04x not open or "
+			"transmit queue full", x->x_dropped - x->x_logged, x->x_vid, x->x_pid);
+		x->x_logged = x->x_dropped;
+		x->x_logtime = clock_getlogicaltime();
+	}
+}
+
+static t_int *rawhid_out_perform(t_int *w)
+{
+	t_rawhid_out *x = (t_rawhid_out *)(w[1]);
+	int n = (int)(w[2]);
+	int i, j, nslots = x->x_layout.t_nslots;
+
+	if (x->x_mean) {
+		for (i = 0; i < nslots; i++) {
+			t_sample *in = x->x_in[i];
+			double sum = 0;
+			for (j = 0; j < n; j++)
+				sum += in[j];
+			x->x_acc[i] += sum;
+		}
+	} else {
+		for (i = 0; i < nslots; i++)
+			x->x_acc[i] = x->x_in[i][n - 1];
+	}
+	x->x_samples += n;
+	if (++x->x_blocks >= x->x_every) {
+		rawhid_out_pack(x);
+		x->x_blocks = x->x_samples = 0;
+		memset(x->x_acc, 0, nslots * sizeof(x->x_acc[0]));
+	}
+	return (w + 3);
+}
+
+static void rawhid_out_dsp(t_rawhid_out *x, t_signal **sp)
+{
+	int i;
+
+	for (i = 0; i < x->x_nin; i++)
+		x->x_in[i] = sp[i]->s_vec;
+	x->x_blocks = x->x_samples = 0;
+	memset(x->x_acc, 0, sizeof(x->x_acc));
+	dsp_add(rawhid_out_perform, 2, x, sp[0]->s_n);
+}
+
+/* every <blocks> : one report per this many DSP blocks */
+static void rawhid_out_every(t_rawhid_out *x, t_float blocks)
+{
+	x->x_every = (blocks < 1) ? 1 : (int)blocks;
+}
+
+/* mode sample|mean : send the last sample of each period, or the mean over it */
+static void rawhid_out_mode(t_rawhid_out *x, t_symbol *mode)
+{
+	if (mode != gensym("sample") && mode != gensym("mean")) {
+		pd_error(x, "[rawhid_out~] mode: expected sample or mean");
+		return;
+	}
+	x->x_mean = (mode == gensym("mean"));
+}
+
+/* device <vid> <pid> : send to another open device */
+static void rawhid_out_device(t_rawhid_out *x, t_symbol *vid, t_symbol *pid)
+{
+	rawhid_out_setdevice(x, vid, pid);
+}
+
+/* backend [<name>] : send to a device a [rawhid] opened through this backend, such as sim; no
+   name means the platform's own */
+static void rawhid_out_backend(t_rawhid_out *x, t_symbol *s, int argc, t_atom *argv)
+{
+	x->x_backend = argc ? atom_getsymbolarg(0, argc, argv) : NULL;
+}
+
+/* Posts the reports queued and dropped so far. */
+static void rawhid_out_print(t_rawhid_out *x)
+{
+	post("[rawhid_out~] device 0x%04x 0x%04x: %lu reports queued, %lu dropped, one per %d "
+	     "blocks (%s)", x->x_vid, x->x_pid, x->x_sent, x->x_dropped, x->x_every,
+	     x->x_mean ? "mean" : "sample");
+}
+
+static void *rawhid_out_new(t_symbol *s, int argc, t_atom *argv)
+{
+	t_rawhid_out *x = (t_rawhid_out *)pd_new(rawhid_out_class);
+	int i;
+
+	x->x_every = 1;
+	x->x_clock = clock_new(x, (t_method)rawhid_out_tick);
+	if (argc < 2 ||
+	    !rawhid_out_setdevice(x, atom_getsymbolarg(0, argc, argv),
+				  atom_getsymbolarg(1, argc, argv)) ||
+	    !rawhid_layout_parse(x, "[rawhid_out~]", &x->x_layout, argc - 2, argv + 2)) {
+		pd_free(&x->x_obj.ob_pd);
+		return NULL;
+	}
+	x->x_nin = x->x_layout.t_nslots ? x->x_layout.t_nslots : 1;
+	x->x_in = (t_sample **)getbytes(x->x_nin * sizeof(*x->x_in));
+	for (i = 1; i < x->x_nin; i++)
+		inlet_new(&x->x_obj, &x->x_obj.ob_pd, &s_signal, &s_signal);
+	return (void *)x;
+}
+
+static void rawhid_out_free(t_rawhid_out *x)
+{
+	clock_free(x->x_clock);
+	if (x->x_in)
+		freebytes(x->x_in, x->x_nin * sizeof(*x->x_in));
+}
+
+#if defined(_LANGUAGE_C_PLUS_PLUS) || defined(__cplusplus)
+extern "C" {
+#endif
+void rawhid_out_tilde_setup(void)
+{
+	rawhid_out_class = class_new(gensym("rawhid_out~"), (t_newmethod)(t_method)rawhid_out_new,
+				     (t_method)rawhid_out_free, sizeof(t_rawhid_out), CLASS_DEFAULT,
+				     A_GIMME, 0);
+	CLASS_MAINSIGNALIN(rawhid_out_class, t_rawhid_out, x_f);
+	class_addmethod(rawhid_out_class, (t_method)rawhid_out_dsp, gensym("dsp"), A_CANT, 0);
+	class_addmethod(rawhid_out_class, (t_method)rawhid_out_every, gensym("every"), A_FLOAT, 0);
+	class_addmethod(rawhid_out_class, (t_method)rawhid_out_mode, gensym("mode"), A_SYMBOL, 0);
+	class_addmethod(rawhid_out_class, (t_method)rawhid_out_device, gensym("device"), A_SYMBOL,
+			A_SYMBOL, 0);
+	class_addmethod(rawhid_out_class, (t_method)rawhid_out_backend, gensym("backend"), A_GIMME,
+			0);
+	class_addmethod(rawhid_out_class, (t_method)rawhid_out_print, gensym("print"), 0);
+	rawhid_out_port = gensym(RAWHID_PORT);
+	rawhid_out_queue = gensym("queue");
+}
+#if defined(_LANGUAGE_C_PLUS_PLUS) || defined(__cplusplus)
+}
+#endif
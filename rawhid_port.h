@@ -0,0 +1,19 @@
+/* How [rawhid_out~] reaches the devices [rawhid] has open, for the RAWHID Pd External.
+ *
+ * The two objects are built into separate binaries and cannot see each other's statics, so
+ * rawhid binds a port object to RAWHID_PORT when it is loaded. [rawhid_out~] looks the symbol's
+ * s_thing up and fetches the port's "queue" method with zgetfn(). It queues one report of
+ * RAWHID_BLOCK_SIZE bytes on the rt lane of the device with the given ids that a [rawhid] has
+ * open through the named backend (NULL for the platform's own), and returns 0 if there is none
+ * or its lane is full. Until a [rawhid] has been loaded there is no port.
+ */
+
+#ifndef RAWHID_PORT_H
+#define RAWHID_PORT_H
+
+#define RAWHID_PORT "#rawhid_port"
+
+typedef int (*t_rawhid_port_queue)(t_pd *port, t_symbol *backend, int vid, int pid,
+				   unsigned char *frame);
+
+#endif
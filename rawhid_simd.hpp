@@ -0,0 +1,278 @@
+/* Conversion kernels between report bytes and Pd atoms for the RAWHID Pd External.
+ *
+ *  rawhid_bytes_to_atoms - fill an atom array with one float per byte
+ *  rawhid_atoms_to_bytes - convert an atom array to bytes, like (atom_getint(a) & 0xFF)
+ *  rawhid_words_to_bytes - the same for the float words of a Pd array
+ *  rawhid_simd_init - pick the best kernels for the running CPU
+ *  rawhid_simd_name - name of the kernels in use
+ *
+ * The vector versions write and read t_atom directly, so they are only built when a t_atom is
+ * 16 bytes with its (single precision) float 8 bytes in, as on every 64-bit Pd. Everything else
+ * uses the scalar loops. AVX2 is compiled with a target attribute and chosen at run time, so the
+ * external itself does not require it.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__SSE2__) || defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RAWHID_HAVE_SSE2 1
+#if defined(__GNUC__)
+#include <immintrin.h>
+#define RAWHID_HAVE_AVX2 1
+#endif
+#endif
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define RAWHID_HAVE_NEON 1
+#endif
+
+/* the vector kernels assume this atom layout */
+#define RAWHID_ATOM_VECTORIZABLE                                                                   \
+	(sizeof(t_atom) == 16 && offsetof(t_atom, a_w) == 8 && sizeof(t_float) == 4)
+#define RAWHID_WORD_VECTORIZABLE (sizeof(t_word) == 8 && sizeof(t_float) == 4)
+
+typedef void (*t_rawhid_b2a)(const unsigned char *src, t_atom *dst, int n);
+typedef void (*t_rawhid_a2b)(const t_atom *src, unsigned char *dst, int n);
+typedef void (*t_rawhid_w2b)(const t_word *src, unsigned char *dst, int n);
+
+static void rawhid_bytes_to_atoms_scalar(const unsigned char *src, t_atom *dst, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		SETFLOAT(dst + i, (t_float)src[i]);
+	}
+}
+
+static void rawhid_atoms_to_bytes_scalar(const t_atom *src, unsigned char *dst, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		dst[i] = ((unsigned char)atom_getint((t_atom *)src + i)) & 0xFF; /* brutal conv */
+	}
+}
+
+static void rawhid_words_to_bytes_scalar(const t_word *src, unsigned char *dst, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		dst[i] = ((unsigned char)(int)src[i].w_float) & 0xFF;
+	}
+}
+
+#ifdef RAWHID_HAVE_SSE2
+/* 4 bytes -> 4 atoms {A_FLOAT, 0, f, 0} per iteration */
+static void rawhid_bytes_to_atoms_sse2(const unsigned char *src, t_atom *dst, int n)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i type = _mm_set_epi32(0, A_FLOAT, 0, A_FLOAT);
+	__m128i *out = (__m128i *)dst;
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4, out += 4) {
+		int32_t b4;
+		__m128i v, lo, hi;
+		memcpy(&b4, src + i, 4);
+		v = _mm_cvtsi32_si128(b4);
+		v = _mm_unpacklo_epi16(_mm_unpacklo_epi8(v, zero), zero);
+		v = _mm_castps_si128(_mm_cvtepi32_ps(v));
+		lo = _mm_unpacklo_epi32(v, zero); /* f0 0 f1 0 */
+		hi = _mm_unpackhi_epi32(v, zero); /* f2 0 f3 0 */
+		_mm_storeu_si128(out + 0, _mm_unpacklo_epi64(type, lo));
+		_mm_storeu_si128(out + 1, _mm_unpackhi_epi64(type, lo));
+		_mm_storeu_si128(out + 2, _mm_unpacklo_epi64(type, hi));
+		_mm_storeu_si128(out + 3, _mm_unpackhi_epi64(type, hi));
+	}
+	rawhid_bytes_to_atoms_scalar(src + i, dst + i, n - i);
+}
+
+/* gathers the type and float words of 4 atoms and converts them to 4 masked ints */
+static __m128i rawhid_atoms4_sse2(const t_atom *src)
+{
+	const __m128 *in = (const __m128 *)src;
+	__m128 a0 = _mm_loadu_ps((const float *)(in + 0));
+	__m128 a1 = _mm_loadu_ps((const float *)(in + 1));
+	__m128 a2 = _mm_loadu_ps((const float *)(in + 2));
+	__m128 a3 = _mm_loadu_ps((const float *)(in + 3));
+	__m128 f01 = _mm_shuffle_ps(a0, a1, _MM_SHUFFLE(2, 0, 2, 0)); /* t0 f0 t1 f1 */
+	__m128 f23 = _mm_shuffle_ps(a2, a3, _MM_SHUFFLE(2, 0, 2, 0)); /* t2 f2 t3 f3 */
+	__m128 f = _mm_shuffle_ps(f01, f23, _MM_SHUFFLE(3, 1, 3, 1));
+	__m128i t = _mm_castps_si128(_mm_shuffle_ps(f01, f23, _MM_SHUFFLE(2, 0, 2, 0)));
+	__m128i isfloat = _mm_cmpeq_epi32(t, _mm_set1_epi32(A_FLOAT));
+	__m128i v = _mm_cvttps_epi32(f);
+	return _mm_and_si128(_mm_and_si128(v, isfloat), _mm_set1_epi32(0xFF));
+}
+
+static void rawhid_atoms_to_bytes_sse2(const t_atom *src, unsigned char *dst, int n)
+{
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m128i lo = rawhid_atoms4_sse2(src + i);
+		__m128i hi = rawhid_atoms4_sse2(src + i + 4);
+		__m128i w = _mm_packs_epi32(lo, hi);
+		_mm_storel_epi64((__m128i *)(dst + i), _mm_packus_epi16(w, w));
+	}
+	rawhid_atoms_to_bytes_scalar(src + i, dst + i, n - i);
+}
+
+/* array words are {f, pad}, so two shuffles pick 4 floats out of 4 words */
+static __m128i rawhid_words4_sse2(const t_word *src)
+{
+	__m128 w01 = _mm_loadu_ps((const float *)src);
+	__m128 w23 = _mm_loadu_ps((const float *)(src + 2));
+	__m128i v = _mm_cvttps_epi32(_mm_shuffle_ps(w01, w23, _MM_SHUFFLE(2, 0, 2, 0)));
+	return _mm_and_si128(v, _mm_set1_epi32(0xFF));
+}
+
+static void rawhid_words_to_bytes_sse2(const t_word *src, unsigned char *dst, int n)
+{
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m128i w = _mm_packs_epi32(rawhid_words4_sse2(src + i), rawhid_words4_sse2(src + i + 4));
+		_mm_storel_epi64((__m128i *)(dst + i), _mm_packus_epi16(w, w));
+	}
+	rawhid_words_to_bytes_scalar(src + i, dst + i, n - i);
+}
+#endif
+
+#ifdef RAWHID_HAVE_AVX2
+/* 8 bytes -> 8 atoms per iteration, two atoms per 256-bit store */
+__attribute__((target("avx2"))) static void rawhid_bytes_to_atoms_avx2(const unsigned char *src,
+									 t_atom *dst, int n)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i type = _mm256_set_epi32(0, A_FLOAT, 0, A_FLOAT, 0, A_FLOAT, 0, A_FLOAT);
+	const __m256i order = _mm256_set_epi32(7, 5, 3, 1, 6, 4, 2, 0);
+	__m256i *out = (__m256i *)dst;
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8, out += 4) {
+		__m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+		__m256i lo, hi;
+		v = _mm256_castps_si256(_mm256_cvtepi32_ps(v));
+		/* f0 f2 f4 f6 | f1 f3 f5 f7, so that in-lane unpacks put atoms in order */
+		v = _mm256_permutevar8x32_epi32(v, order);
+		lo = _mm256_unpacklo_epi32(v, zero); /* f0 0 f2 0 | f1 0 f3 0 */
+		hi = _mm256_unpackhi_epi32(v, zero); /* f4 0 f6 0 | f5 0 f7 0 */
+		_mm256_storeu_si256(out + 0, _mm256_unpacklo_epi64(type, lo));
+		_mm256_storeu_si256(out + 1, _mm256_unpackhi_epi64(type, lo));
+		_mm256_storeu_si256(out + 2, _mm256_unpacklo_epi64(type, hi));
+		_mm256_storeu_si256(out + 3, _mm256_unpackhi_epi64(type, hi));
+	}
+	rawhid_bytes_to_atoms_sse2(src + i, dst + i, n - i);
+}
+
+/* same shuffles as the SSE2 version on two atoms per lane; gathers turned out slower */
+__attribute__((target("avx2"))) static void rawhid_atoms_to_bytes_avx2(const t_atom *src,
+									 unsigned char *dst, int n)
+{
+	const __m256i order = _mm256_set_epi32(7, 3, 6, 2, 5, 1, 4, 0);
+	const __m256i flt = _mm256_set1_epi32(A_FLOAT);
+	const __m256i mask = _mm256_set1_epi32(0xFF);
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		const float *in = (const float *)(src + i);
+		__m256 l0 = _mm256_loadu_ps(in + 0);
+		__m256 l1 = _mm256_loadu_ps(in + 8);
+		__m256 l2 = _mm256_loadu_ps(in + 16);
+		__m256 l3 = _mm256_loadu_ps(in + 24);
+		__m256 s01 = _mm256_shuffle_ps(l0, l1, _MM_SHUFFLE(2, 0, 2, 0)); /* t0 f0 t2 f2 | t1 f1 t3 f3 */
+		__m256 s23 = _mm256_shuffle_ps(l2, l3, _MM_SHUFFLE(2, 0, 2, 0)); /* t4 f4 t6 f6 | t5 f5 t7 f7 */
+		__m256 f = _mm256_shuffle_ps(s01, s23, _MM_SHUFFLE(3, 1, 3, 1));
+		__m256i t = _mm256_castps_si256(_mm256_shuffle_ps(s01, s23, _MM_SHUFFLE(2, 0, 2, 0)));
+		__m256i v = _mm256_and_si256(_mm256_cvttps_epi32(f), _mm256_cmpeq_epi32(t, flt));
+		__m128i w;
+		v = _mm256_permutevar8x32_epi32(_mm256_and_si256(v, mask), order);
+		w = _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+		_mm_storel_epi64((__m128i *)(dst + i), _mm_packus_epi16(w, w));
+	}
+	rawhid_atoms_to_bytes_sse2(src + i, dst + i, n - i);
+}
+#endif
+
+#ifdef RAWHID_HAVE_NEON
+static void rawhid_bytes_to_atoms_neon(const unsigned char *src, t_atom *dst, int n)
+{
+	const uint32x4_t type = vdupq_n_u32(A_FLOAT);
+	uint32_t *out = (uint32_t *)dst;
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8, out += 32) {
+		uint16x8_t w = vmovl_u8(vld1_u8(src + i));
+		float32x4_t lo = vcvtq_f32_u32(vmovl_u16(vget_low_u16(w)));
+		float32x4_t hi = vcvtq_f32_u32(vmovl_u16(vget_high_u16(w)));
+		/* interleave {type, 0, f, 0} with a 4-way store */
+		uint32x4x4_t a0 = {{type, vdupq_n_u32(0), vreinterpretq_u32_f32(lo), vdupq_n_u32(0)}};
+		uint32x4x4_t a1 = {{type, vdupq_n_u32(0), vreinterpretq_u32_f32(hi), vdupq_n_u32(0)}};
+		vst4q_u32(out, a0);
+		vst4q_u32(out + 16, a1);
+	}
+	rawhid_bytes_to_atoms_scalar(src + i, dst + i, n - i);
+}
+
+static void rawhid_atoms_to_bytes_neon(const t_atom *src, unsigned char *dst, int n)
+{
+	const uint32x4_t flt = vdupq_n_u32(A_FLOAT);
+	const uint32_t *in = (const uint32_t *)src;
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8, in += 32) {
+		uint32x4x4_t a0 = vld4q_u32(in);
+		uint32x4x4_t a1 = vld4q_u32(in + 16);
+		/* convert signed so that negative values keep their low byte, as in the cast */
+		uint32x4_t v0 = vreinterpretq_u32_s32(vcvtq_s32_f32(vreinterpretq_f32_u32(a0.val[2])));
+		uint32x4_t v1 = vreinterpretq_u32_s32(vcvtq_s32_f32(vreinterpretq_f32_u32(a1.val[2])));
+		uint16x8_t w;
+		v0 = vandq_u32(v0, vceqq_u32(a0.val[0], flt));
+		v1 = vandq_u32(v1, vceqq_u32(a1.val[0], flt));
+		w = vcombine_u16(vmovn_u32(v0), vmovn_u32(v1));
+		vst1_u8(dst + i, vmovn_u16(w));
+	}
+	rawhid_atoms_to_bytes_scalar(src + i, dst + i, n - i);
+}
+#endif
+
+static t_rawhid_b2a rawhid_bytes_to_atoms = rawhid_bytes_to_atoms_scalar;
+static t_rawhid_a2b rawhid_atoms_to_bytes = rawhid_atoms_to_bytes_scalar;
+static t_rawhid_w2b rawhid_words_to_bytes = rawhid_words_to_bytes_scalar;
+static const char *rawhid_simd_kernels = "scalar";
+
+static void rawhid_simd_init(void)
+{
+#ifdef RAWHID_HAVE_SSE2
+	if (RAWHID_WORD_VECTORIZABLE)
+		rawhid_words_to_bytes = rawhid_words_to_bytes_sse2;
+#endif
+	if (!RAWHID_ATOM_VECTORIZABLE)
+		return;
+#ifdef RAWHID_HAVE_NEON
+	rawhid_bytes_to_atoms = rawhid_bytes_to_atoms_neon;
+	rawhid_atoms_to_bytes = rawhid_atoms_to_bytes_neon;
+	rawhid_simd_kernels = "neon";
+#endif
+#ifdef RAWHID_HAVE_SSE2
+	rawhid_bytes_to_atoms = rawhid_bytes_to_atoms_sse2;
+	rawhid_atoms_to_bytes = rawhid_atoms_to_bytes_sse2;
+	rawhid_simd_kernels = "sse2";
+#endif
+#ifdef RAWHID_HAVE_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		rawhid_bytes_to_atoms = rawhid_bytes_to_atoms_avx2;
+		rawhid_atoms_to_bytes = rawhid_atoms_to_bytes_avx2;
+		rawhid_simd_kernels = "avx2";
+	}
+#endif
+}
+
+static const char *rawhid_simd_name(void)
+{
+	return rawhid_simd_kernels;
+}
@@ -0,0 +1,51 @@
+/* Static tracepoints on the receive and transmit paths of rawhid.c.
+ *
+ * Built with -DRAWHID_TRACE=1 (make TRACE=1) where <sys/sdt.h> is installed, e.g. from
+ * systemtap-sdt-dev, every RAWHID_TRACE* below is a USDT probe of the "rawhid" provider that
+ * perf, bpftrace or SystemTap can attach to. Otherwise they expand to nothing and their
+ * arguments are not evaluated.
+ *
+ *   rx_arrive  (dev, id, len, arrival)  report taken from the backend
+ *   rx_enqueue (dev, id, len, arrival)  report went into the inbound queue
+ *   rx_dequeue (dev, id, len, arrival)  report taken out of it for dispatch
+ *   rx_deliver (dev, id, len, arrival)  report output to every subscriber
+ *   tx_enqueue (dev, id, len, lane)     report queued for sending
+ *   tx_send    (dev, id, len, result, queued)  backend send returned
+ *
+ * dev is vid << 16 | pid and id the first byte of the report. arrival is the backend's
+ * CLOCK_MONOTONIC time in ns, the clock of bpftrace's nsecs, so a stage latency is e.g.
+ *
+ *   bpftrace -e 'usdt:./rawhid.pd_linux:rawhid:rx_deliver { @us = hist((nsecs - arg3) / 1000) }'
+ *
+ * queued is the time the report waited in its lane, in microseconds of Pd logical time.
+ */
+#ifndef RAWHID_TRACE_HPP
+#define RAWHID_TRACE_HPP
+
+#ifndef RAWHID_TRACE
+#define RAWHID_TRACE 0
+#endif
+
+#if RAWHID_TRACE && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define RAWHID_TRACE_SDT 1
+#endif
+#endif
+
+#ifdef RAWHID_TRACE_SDT
+#define RAWHID_TRACE4(name, a, b, c, d) DTRACE_PROBE4(rawhid, name, a, b, c, d)
+#define RAWHID_TRACE5(name, a, b, c, d, e) DTRACE_PROBE5(rawhid, name, a, b, c, d, e)
+#else
+#if RAWHID_TRACE
+#warning "RAWHID_TRACE needs <sys/sdt.h>, building without tracepoints"
+#endif
+#define RAWHID_TRACE4(name, a, b, c, d) do { } while (0)
+#define RAWHID_TRACE5(name, a, b, c, d, e) do { } while (0)
+#endif
+
+/* dev and arrival arguments, from a hub and from seconds */
+#define RAWHID_TRACE_DEV(h) ((long)(h)->h_vid << 16 | (h)->h_pid)
+#define RAWHID_TRACE_NS(t) ((long long)((t) * 1e9))
+
+#endif